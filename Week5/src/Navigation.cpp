@@ -562,13 +562,21 @@ void draw(
 	);
 }
 
-void update(DrawingWindow &window, CameraEnvironment &cameraEnv) {
+// Milliseconds to sleep waiting for input when the scene hasn't changed
+int IDLE_TIMEOUT = 100;
+// Whether the camera circles the model every frame (O toggles it) - the window only sleeps while it doesn't
+bool ORBIT = true;
+
+// Anything that changes what would be drawn must bump sceneVersion, otherwise the frame is not redrawn
+void update(DrawingWindow &window, CameraEnvironment &cameraEnv, unsigned int &sceneVersion) {
+	if (!ORBIT) return;
 	float ROTATION_STEP = M_PI * 0.01;
 	cameraEnv.position = rotateY(cameraEnv.position, ROTATION_STEP);
 	cameraEnv.lookAt(glm::vec3(0.0, 0.0, 0.0));
+	sceneVersion++;
 }
 
-void handleEvent(SDL_Event event, DrawingWindow &window, CameraEnvironment &cameraEnv) {
+void handleEvent(SDL_Event event, DrawingWindow &window, CameraEnvironment &cameraEnv, unsigned int &sceneVersion) {
 	float TRANSLATION_STEP = 0.05;
 	float ROTATION_STEP = M_PI * 0.01;
 	if (event.type == SDL_KEYDOWN) {
@@ -585,6 +593,9 @@ void handleEvent(SDL_Event event, DrawingWindow &window, CameraEnvironment &came
 		else if (event.key.keysym.sym == SDLK_u) cameraEnv.rotateY(ROTATION_STEP);
 		else if (event.key.keysym.sym == SDLK_y) cameraEnv.rotateY(-ROTATION_STEP);
 		else if (event.key.keysym.sym == SDLK_l) cameraEnv.lookAt(glm::vec3(0.0, 0.0, 0.0));
+		else if (event.key.keysym.sym == SDLK_o) ORBIT = !ORBIT;
+		else return;
+		sceneVersion++;
 
 	} else if (event.type == SDL_MOUSEBUTTONDOWN) window.savePPM("output.ppm");
 }
@@ -607,19 +618,31 @@ int main(int argc, char *argv[]) {
 		0.0, 0.0, 1.0
 	);
 	
+	unsigned int sceneVersion = 1;
+	unsigned int drawnVersion = 0;
 	while (true) {
 		// We MUST poll for events - otherwise the window will freeze !
-		if (window.pollForInputEvents(event)) handleEvent(event, window, cameraEnv);
+		// When nothing has changed since the last frame, sleep until there is input instead
+		bool gotEvent = (sceneVersion == drawnVersion) ?
+			window.waitForInputEvents(event, IDLE_TIMEOUT) :
+			window.pollForInputEvents(event);
+		if (gotEvent) handleEvent(event, window, cameraEnv, sceneVersion);
 		
-		update(window, cameraEnv);
-		draw(
-			window,
-			triangles,
-			materials,
-			depthBuffer,
-			cameraEnv
-		);
-		// Need to render the frame at the end, or nothing actually gets shown on the screen !
-		window.renderFrame();
+		update(window, cameraEnv, sceneVersion);
+		if (sceneVersion != drawnVersion) {
+			draw(
+				window,
+				triangles,
+				materials,
+				depthBuffer,
+				cameraEnv
+			);
+			drawnVersion = sceneVersion;
+			// Need to render the frame at the end, or nothing actually gets shown on the screen !
+			window.renderFrame();
+		} else if (gotEvent && event.type == SDL_WINDOWEVENT) {
+			// The window may need repainting even though the frame is unchanged
+			window.renderFrame();
+		}
 	}
 }
\ No newline at end of file
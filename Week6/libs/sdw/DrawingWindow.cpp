@@ -55,15 +55,19 @@ void DrawingWindow::savePPM(const std::string &filename) const {
 	outputStream.close();
 }
 
+void DrawingWindow::quitIfRequested(const SDL_Event &event) {
+	if ((event.type == SDL_QUIT) || ((event.type == SDL_KEYDOWN) && (event.key.keysym.sym == SDLK_ESCAPE))) {
+		SDL_DestroyTexture(texture);
+		SDL_DestroyRenderer(renderer);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		printMessageAndQuit("Exiting", nullptr);
+	}
+}
+
 bool DrawingWindow::pollForInputEvents(SDL_Event &event) {
 	if (SDL_PollEvent(&event)) {
-		if ((event.type == SDL_QUIT) || ((event.type == SDL_KEYDOWN) && (event.key.keysym.sym == SDLK_ESCAPE))) {
-			SDL_DestroyTexture(texture);
-			SDL_DestroyRenderer(renderer);
-			SDL_DestroyWindow(window);
-			SDL_Quit();
-			printMessageAndQuit("Exiting", nullptr);
-		}
+		quitIfRequested(event);
 		SDL_Event dummy;
 		// Clear the event queue by getting all available events
 		// This seems like bad practice (because it will skip some events) however preventing backlog is paramount !
@@ -73,6 +77,14 @@ bool DrawingWindow::pollForInputEvents(SDL_Event &event) {
 	return false;
 }
 
+// Sleeps until an event arrives or timeout milliseconds pass, returns false on timeout
+// Unlike pollForInputEvents, nothing queued behind the event is thrown away
+bool DrawingWindow::waitForInputEvents(SDL_Event &event, int timeout) {
+	if (!SDL_WaitEventTimeout(&event, timeout)) return false;
+	quitIfRequested(event);
+	return true;
+}
+
 void DrawingWindow::setPixelColour(size_t x, size_t y, uint32_t colour) {
 	if ((x >= width) || (y >= height)) {
 		std::cout << x << "," << y << " not on visible screen area" << std::endl;
@@ -17,6 +17,8 @@ private:
 	SDL_Texture *texture;
 	std::vector<uint32_t> pixelBuffer;
 
+	void quitIfRequested(const SDL_Event &event);
+
 public:
 	DrawingWindow();
 	DrawingWindow(int w, int h, bool fullscreen);
@@ -24,6 +26,7 @@ public:
 	void savePPM(const std::string &filename) const;
 	void saveBMP(const std::string &filename) const;
 	bool pollForInputEvents(SDL_Event &event);
+	bool waitForInputEvents(SDL_Event &event, int timeout);
 	void setPixelColour(size_t x, size_t y, uint32_t colour);
 	uint32_t getPixelColour(size_t x, size_t y);
 	void clearPixels();
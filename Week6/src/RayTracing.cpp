@@ -731,7 +731,11 @@ void rayTrace(
 
 // EVENT LOOPS
 
-void update(DrawingWindow &window, CameraEnvironment &cameraEnv) {
+// Milliseconds to sleep waiting for input when the scene hasn't changed
+int IDLE_TIMEOUT = 100;
+
+// Anything that changes what would be drawn must bump sceneVersion, otherwise the frame is not redrawn
+void update(DrawingWindow &window, CameraEnvironment &cameraEnv, unsigned int &sceneVersion) {
 
 }
 
@@ -739,7 +743,8 @@ void handleEvent(
 		SDL_Event event,
 		DrawingWindow &window,
 		CameraEnvironment &cameraEnv,
-		RenderingMethod &renderingMethod) {
+		RenderingMethod &renderingMethod,
+		unsigned int &sceneVersion) {
 	float TRANSLATION_STEP = 0.05;
 	float ROTATION_STEP = M_PI * 0.01;
 	if (event.type == SDL_KEYDOWN) {
@@ -759,6 +764,8 @@ void handleEvent(
 		else if (event.key.keysym.sym == SDLK_1) renderingMethod = RASTERISE;
 		else if (event.key.keysym.sym == SDLK_2) renderingMethod = WIREFRAME;
 		else if (event.key.keysym.sym == SDLK_3) renderingMethod = RAY_TRACE;
+		else return;
+		sceneVersion++;
 
 	} else if (event.type == SDL_MOUSEBUTTONDOWN) window.savePPM("output.ppm");
 }
@@ -783,11 +790,23 @@ int main(int argc, char *argv[]) {
 
 	RenderingMethod renderingMethod = RASTERISE;
 	
+	unsigned int sceneVersion = 1;
+	unsigned int drawnVersion = 0;
 	while (true) {
 		// We MUST poll for events - otherwise the window will freeze !
-		if (window.pollForInputEvents(event)) handleEvent(event, window, cameraEnv, renderingMethod);
+		// When nothing has changed since the last frame, sleep until there is input instead
+		bool gotEvent = (sceneVersion == drawnVersion) ?
+			window.waitForInputEvents(event, IDLE_TIMEOUT) :
+			window.pollForInputEvents(event);
+		if (gotEvent) handleEvent(event, window, cameraEnv, renderingMethod, sceneVersion);
 		
-		update(window, cameraEnv);
+		update(window, cameraEnv, sceneVersion);
+		if (sceneVersion == drawnVersion) {
+			// The window may need repainting even though the frame is unchanged
+			if (gotEvent && event.type == SDL_WINDOWEVENT) window.renderFrame();
+			continue;
+		}
+
 		if (renderingMethod == RASTERISE) {
 			rasterise(
 				window,
@@ -801,6 +820,7 @@ int main(int argc, char *argv[]) {
 		} else if (renderingMethod == RAY_TRACE) {
 			rayTrace(window, triangles, materials, cameraEnv);
 		} 
+		drawnVersion = sceneVersion;
 
 		window.renderFrame();
 	}
@@ -0,0 +1,870 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include "BVH.h"
+#include "TileScheduler.h"
+
+// Leaves stop splitting once they hold this many triangles or fewer
+#define BVH_LEAF_SIZE 4
+// Leaves can hold up to this many when the surface area heuristic says splitting them wouldn't pay off
+#define BVH_MAX_LEAF_SIZE 8
+// Entries are sorted into this many equal slices of their centroids' range along each axis to find the best split
+#define BVH_BINS 16
+// Ranges at least this big are binned and partitioned by all the threads a chunk at a time,
+// smaller ones are built whole by one thread each
+#define BVH_PARALLEL_SIZE 16384
+#define BVH_CHUNK_SIZE 4096
+// Past this depth every split is an even one, which keeps the tree shallow enough for BVH_STACK_SIZE
+#define BVH_MIDPOINT_DEPTH 32
+#define BVH_STACK_SIZE 96
+// Set on the index of entries that are primitives or instances rather than triangles
+#define BVH_PRIMITIVE_BIT 0x80000000u
+#define BVH_INSTANCE_BIT 0x40000000u
+#define BVH_INDEX_MASK 0x3fffffffu
+// Relative costs of stepping into a node and intersecting an entry, for the surface area heuristic
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_INTERSECTION_COST 1.0f
+// Marks unused child slots of a wide node
+#define BVH_EMPTY_CHILD 0xff
+// A wide node can leave all but one of its children on the stack
+#define BVH_WIDE_STACK_SIZE (BVH_STACK_SIZE * (BVH_WIDTH - 1))
+// Smaller direction components are nudged out to this, as a ray starting on a child's face along it
+// would otherwise multiply zero by infinity, which fast math builds don't handle
+#define BVH_MIN_DIRECTION 1e-20f
+
+static float getSurfaceArea(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
+	glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(0.0f));
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+BVHInstance::BVHInstance(std::shared_ptr<const BVHMesh> mesh, const glm::mat4 &transform) :
+	mesh(mesh), transform(transform), inverseTransform(glm::inverse(transform)),
+	normalTransform(glm::transpose(glm::mat3(glm::inverse(transform)))) {}
+
+// Transforms all eight corners of the mesh's box, since a rotated box's corners move in every direction
+void BVHInstance::getBounds(glm::vec3 &min, glm::vec3 &max) const {
+	glm::vec3 meshMin;
+	glm::vec3 meshMax;
+	mesh->bvh.getBounds(meshMin, meshMax);
+	min = glm::vec3(std::numeric_limits<float>::max());
+	max = glm::vec3(-std::numeric_limits<float>::max());
+	if (meshMin.x > meshMax.x) return;
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner((i & 1) ? meshMax.x : meshMin.x, (i & 2) ? meshMax.y : meshMin.y, (i & 4) ? meshMax.z : meshMin.z);
+		glm::vec3 point = glm::vec3(transform * glm::vec4(corner, 1.0f));
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+}
+
+BVHMesh::BVHMesh(const std::vector<ModelTriangle> &triangles) : triangles(triangles), bvh(triangles) {}
+
+BVH::BVH() : cost(0.0f), builtCost(0.0f) {}
+
+BVH::BVH(
+		const std::vector<ModelTriangle> &modelTriangles,
+		const std::vector<Primitive> &scenePrimitives,
+		const std::vector<BVHInstance> &sceneInstances) :
+	primitives(scenePrimitives), instances(sceneInstances), cost(0.0f), builtCost(0.0f) {
+	for (size_t i = 0; i < modelTriangles.size(); i++) {
+		const std::array<glm::vec3, 3> &vertices = modelTriangles[i].vertices;
+		Triangle triangle;
+		triangle.vertex0 = vertices[0];
+		triangle.edge1 = vertices[1] - vertices[0];
+		triangle.edge2 = vertices[2] - vertices[0];
+		triangle.index = uint32_t(i);
+		triangles.push_back(triangle);
+	}
+	// The build only looks at the corners, so a box from vertex0 to vertex0 + edge1 gets the primitive's or instance's bounds
+	// Entries are numbered by their position while building, and given their own index afterwards
+	std::vector<uint32_t> boxedEntries;
+	auto addBox = [&](const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, uint32_t index) {
+		boxedEntries.push_back(index);
+		Triangle entry;
+		entry.vertex0 = boundsMin;
+		entry.edge1 = boundsMax - boundsMin;
+		entry.edge2 = glm::vec3(0.0);
+		entry.index = uint32_t(triangles.size());
+		triangles.push_back(entry);
+	};
+	for (size_t i = 0; i < primitives.size(); i++) {
+		if (!primitives[i].isBounded()) {
+			unboundedPrimitives.push_back(uint32_t(i));
+			continue;
+		}
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		primitives[i].getBounds(boundsMin, boundsMax);
+		addBox(boundsMin, boundsMax, uint32_t(i) | BVH_PRIMITIVE_BIT);
+	}
+	for (size_t i = 0; i < instances.size(); i++) {
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		instances[i].getBounds(boundsMin, boundsMax);
+		// An empty mesh can never be hit
+		if (boundsMin.x > boundsMax.x) continue;
+		addBox(boundsMin, boundsMax, uint32_t(i) | BVH_INSTANCE_BIT);
+	}
+	if (triangles.empty()) return;
+	// A binary tree over n leaves never needs more than 2n - 1 nodes, and threads take theirs from a shared count
+	nodes.resize(2 * triangles.size());
+	std::atomic<uint32_t> nodeCount(1);
+	std::vector<BuildEntry> entries(triangles.size());
+	getTileScheduler().parallelFor((triangles.size() + BVH_CHUNK_SIZE - 1) / BVH_CHUNK_SIZE, [&](size_t chunk) {
+		for (size_t i = chunk * BVH_CHUNK_SIZE; i < std::min(triangles.size(), (chunk + 1) * BVH_CHUNK_SIZE); i++) {
+			getEntryBounds(triangles[i], entries[i].boundsMin, entries[i].boundsMax);
+			entries[i].triangle = uint32_t(i);
+		}
+	});
+	BuildBin root = measure(entries.data(), uint32_t(entries.size()));
+	nodes[0].boundsMin = root.boundsMin;
+	nodes[0].boundsMax = root.boundsMax;
+	BuildTask rootTask = {0, 0, uint32_t(triangles.size()), 0, root.centroidMin, root.centroidMax};
+	std::vector<BuildTask> tasks;
+	build(rootTask, entries, nodeCount, &tasks);
+	getTileScheduler().parallelFor(tasks.size(), [&](size_t i) {
+		build(tasks[i], entries, nodeCount, nullptr);
+	});
+	nodes.resize(nodeCount);
+	nodes.shrink_to_fit();
+	std::vector<Triangle> sortedTriangles(triangles.size());
+	for (size_t i = 0; i < entries.size(); i++) {
+		sortedTriangles[i] = triangles[entries[i].triangle];
+		if (sortedTriangles[i].index < modelTriangles.size()) continue;
+		sortedTriangles[i].index = boxedEntries[sortedTriangles[i].index - modelTriangles.size()];
+	}
+	triangles.swap(sortedTriangles);
+	cost = computeCost();
+	builtCost = cost;
+}
+
+size_t BVH::nodeCount() const {
+	return isWide() ? wideNodes.size() : nodes.size();
+}
+
+size_t BVH::getNodeMemory() const {
+	return nodes.size() * sizeof(BVHNode) + wideNodes.size() * sizeof(BVHWideNode);
+}
+
+void BVH::getBounds(glm::vec3 &min, glm::vec3 &max) const {
+	if (isWide()) {
+		min = wideNodes[0].boundsMin;
+		max = wideNodes[0].boundsMin + 255.0f * wideNodes[0].step;
+		return;
+	}
+	if (nodes.empty()) {
+		min = glm::vec3(std::numeric_limits<float>::max());
+		max = glm::vec3(-std::numeric_limits<float>::max());
+		return;
+	}
+	min = nodes[0].boundsMin;
+	max = nodes[0].boundsMax;
+}
+
+// Children always come after their parent, so going backwards through the nodes updates every child before its parent
+void BVH::refit(const std::vector<ModelTriangle> &modelTriangles) {
+	for (size_t i = 0; i < triangles.size(); i++) {
+		Triangle &entry = triangles[i];
+		if (entry.index & (BVH_PRIMITIVE_BIT | BVH_INSTANCE_BIT)) continue;
+		const std::array<glm::vec3, 3> &vertices = modelTriangles[entry.index].vertices;
+		entry.vertex0 = vertices[0];
+		entry.edge1 = vertices[1] - vertices[0];
+		entry.edge2 = vertices[2] - vertices[0];
+	}
+	// Wide nodes are likewise stored after their parent
+	for (size_t i = wideNodes.size(); i-- > 0;) {
+		BVHWideNode &node = wideNodes[i];
+		glm::vec3 childMins[BVH_WIDTH];
+		glm::vec3 childMaxs[BVH_WIDTH];
+		for (int child = 0; child < BVH_WIDTH; child++) {
+			childMins[child] = glm::vec3(std::numeric_limits<float>::max());
+			childMaxs[child] = glm::vec3(-std::numeric_limits<float>::max());
+			if (node.counts[child] == BVH_EMPTY_CHILD) continue;
+			if (node.counts[child] == 0) {
+				const BVHWideNode &childNode = wideNodes[node.children[child]];
+				childMins[child] = childNode.boundsMin;
+				childMaxs[child] = childNode.boundsMin + 255.0f * childNode.step;
+				continue;
+			}
+			for (uint32_t j = node.children[child]; j < node.children[child] + node.counts[child]; j++) {
+				glm::vec3 entryMin;
+				glm::vec3 entryMax;
+				getEntryBounds(triangles[j], entryMin, entryMax);
+				childMins[child] = glm::min(childMins[child], entryMin);
+				childMaxs[child] = glm::max(childMaxs[child], entryMax);
+			}
+		}
+		setWideBounds(node, childMins, childMaxs);
+	}
+	for (size_t i = nodes.size(); i-- > 0;) {
+		BVHNode &node = nodes[i];
+		if (node.count == 0) {
+			node.boundsMin = glm::min(nodes[node.leftOrFirst].boundsMin, nodes[node.leftOrFirst + 1].boundsMin);
+			node.boundsMax = glm::max(nodes[node.leftOrFirst].boundsMax, nodes[node.leftOrFirst + 1].boundsMax);
+			continue;
+		}
+		node.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+		node.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+		for (uint32_t j = node.leftOrFirst; j < node.leftOrFirst + node.count; j++) {
+			glm::vec3 entryMin;
+			glm::vec3 entryMax;
+			getEntryBounds(triangles[j], entryMin, entryMax);
+			node.boundsMin = glm::min(node.boundsMin, entryMin);
+			node.boundsMax = glm::max(node.boundsMax, entryMax);
+		}
+	}
+	cost = computeCost();
+}
+
+// A ray through the root passes through each node with the chance of their surface areas' ratio
+// A wide node's children are tested together, so visiting one costs a single step into a node
+float BVH::computeCost() const {
+	if (isWide()) {
+		glm::vec3 rootMin;
+		glm::vec3 rootMax;
+		getBounds(rootMin, rootMax);
+		float rootArea = getSurfaceArea(rootMin, rootMax);
+		if (rootArea <= 0.0f) return 0.0f;
+		float total = BVH_TRAVERSAL_COST;
+		for (size_t i = 0; i < wideNodes.size(); i++) {
+			for (int child = 0; child < BVH_WIDTH; child++) {
+				uint8_t count = wideNodes[i].counts[child];
+				if (count == BVH_EMPTY_CHILD) continue;
+				glm::vec3 childMin;
+				glm::vec3 childMax;
+				getWideChildBounds(wideNodes[i], child, childMin, childMax);
+				float work = (count > 0) ? BVH_INTERSECTION_COST * count : BVH_TRAVERSAL_COST;
+				total += getSurfaceArea(childMin, childMax) / rootArea * work;
+			}
+		}
+		return total;
+	}
+	if (nodes.empty()) return 0.0f;
+	float rootArea = getSurfaceArea(nodes[0].boundsMin, nodes[0].boundsMax);
+	if (rootArea <= 0.0f) return 0.0f;
+	float total = 0.0f;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		float work = (nodes[i].count > 0) ? BVH_INTERSECTION_COST * nodes[i].count : BVH_TRAVERSAL_COST;
+		total += getSurfaceArea(nodes[i].boundsMin, nodes[i].boundsMax) / rootArea * work;
+	}
+	return total;
+}
+
+float BVH::getCost() const {
+	return cost;
+}
+
+float BVH::getDegradation() const {
+	return (builtCost > 0.0f) ? cost / builtCost : 1.0f;
+}
+
+const Primitive &BVH::getPrimitive(size_t index) const {
+	return primitives[index];
+}
+
+const BVHInstance &BVH::getInstance(size_t index) const {
+	return instances[index];
+}
+
+void BVH::BuildBin::add(const BuildEntry &entry) {
+	boundsMin = glm::min(boundsMin, entry.boundsMin);
+	boundsMax = glm::max(boundsMax, entry.boundsMax);
+	count++;
+}
+
+void BVH::BuildBin::addCentroid(const BuildEntry &entry) {
+	glm::vec3 centroid = (entry.boundsMin + entry.boundsMax) * 0.5f;
+	centroidMin = glm::min(centroidMin, centroid);
+	centroidMax = glm::max(centroidMax, centroid);
+}
+
+void BVH::BuildBin::add(const BuildBin &other) {
+	boundsMin = glm::min(boundsMin, other.boundsMin);
+	boundsMax = glm::max(boundsMax, other.boundsMax);
+	centroidMin = glm::min(centroidMin, other.centroidMin);
+	centroidMax = glm::max(centroidMax, other.centroidMax);
+	count += other.count;
+}
+
+void BVH::getEntryBounds(const Triangle &entry, glm::vec3 &min, glm::vec3 &max) {
+	glm::vec3 vertex1 = entry.vertex0 + entry.edge1;
+	glm::vec3 vertex2 = entry.vertex0 + entry.edge2;
+	min = glm::min(entry.vertex0, glm::min(vertex1, vertex2));
+	max = glm::max(entry.vertex0, glm::max(vertex1, vertex2));
+}
+
+BVH::BuildBin BVH::measure(const BuildEntry *entries, uint32_t count) {
+	BuildBin bounds;
+	for (uint32_t i = 0; i < count; i++) {
+		bounds.add(entries[i]);
+		bounds.addCentroid(entries[i]);
+	}
+	return bounds;
+}
+
+// Splits the task's entries where the surface area heuristic finds it cheapest, binning their centroids along each axis
+// The bins give the children's boxes and the partition their centroids' boxes, so nothing else reads the entries
+// Children are always given higher node indices than their parent, whichever thread builds them
+void BVH::build(const BuildTask &task, std::vector<BuildEntry> &entries, std::atomic<uint32_t> &nodeCount, std::vector<BuildTask> *tasks) {
+	uint32_t first = task.first;
+	uint32_t count = task.count;
+	BVHNode &node = nodes[task.nodeIndex];
+	if (count <= BVH_LEAF_SIZE) {
+		node.leftOrFirst = first;
+		node.count = count;
+		return;
+	}
+
+	glm::vec3 extent = task.centroidMax - task.centroidMin;
+	glm::vec3 binScale;
+	for (int axis = 0; axis < 3; axis++) binScale[axis] = (extent[axis] > 0.0f) ? BVH_BINS / extent[axis] : 0.0f;
+	auto getBin = [&](const BuildEntry &entry, int axis) {
+		float centroid = (entry.boundsMin[axis] + entry.boundsMax[axis]) * 0.5f;
+		return std::min(int((centroid - task.centroidMin[axis]) * binScale[axis]), BVH_BINS - 1);
+	};
+	auto binEntries = [&](uint32_t from, uint32_t to, BuildBin *bins) {
+		for (uint32_t i = from; i < to; i++) {
+			for (int axis = 0; axis < 3; axis++) bins[axis * BVH_BINS + getBin(entries[i], axis)].add(entries[i]);
+		}
+	};
+
+	// The top of the tree is worked on a chunk at a time by all the threads
+	bool parallel = tasks != nullptr && count >= BVH_PARALLEL_SIZE;
+	size_t chunkCount = (count + BVH_CHUNK_SIZE - 1) / BVH_CHUNK_SIZE;
+	auto getChunkEnd = [&](size_t chunk) { return first + uint32_t(std::min(size_t(count), (chunk + 1) * BVH_CHUNK_SIZE)); };
+	BuildBin bins[3 * BVH_BINS];
+	if (parallel) {
+		std::vector<std::array<BuildBin, 3 * BVH_BINS>> chunkBins(chunkCount);
+		getTileScheduler().parallelFor(chunkCount, [&](size_t chunk) {
+			binEntries(first + uint32_t(chunk * BVH_CHUNK_SIZE), getChunkEnd(chunk), chunkBins[chunk].data());
+		});
+		for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+			for (int i = 0; i < 3 * BVH_BINS; i++) bins[i].add(chunkBins[chunk][i]);
+		}
+	} else binEntries(first, first + count, bins);
+
+	// Sweeps in from both ends so each split between bins is costed in constant time
+	// Splitting after bin i sends bins 0 to i left
+	float bestCost = std::numeric_limits<float>::infinity();
+	int bestAxis = -1;
+	int bestBin = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		if (extent[axis] <= 0.0f) continue;
+		const BuildBin *axisBins = &bins[axis * BVH_BINS];
+		float rightCosts[BVH_BINS];
+		BuildBin right;
+		for (int i = BVH_BINS - 1; i > 0; i--) {
+			right.add(axisBins[i]);
+			rightCosts[i - 1] = (right.count > 0) ? getSurfaceArea(right.boundsMin, right.boundsMax) * right.count : 0.0f;
+		}
+		BuildBin left;
+		for (int i = 0; i < BVH_BINS - 1; i++) {
+			left.add(axisBins[i]);
+			if (left.count == 0 || left.count == count) continue;
+			float splitCost = getSurfaceArea(left.boundsMin, left.boundsMax) * left.count + rightCosts[i];
+			if (splitCost < bestCost) {
+				bestCost = splitCost;
+				bestAxis = axis;
+				bestBin = i;
+			}
+		}
+	}
+
+	float area = getSurfaceArea(node.boundsMin, node.boundsMax);
+	float splitCost = BVH_TRAVERSAL_COST + BVH_INTERSECTION_COST * bestCost / std::max(area, std::numeric_limits<float>::min());
+	if (count <= BVH_MAX_LEAF_SIZE && BVH_INTERSECTION_COST * count <= splitCost) {
+		node.leftOrFirst = first;
+		node.count = count;
+		return;
+	}
+
+	BuildEntry *begin = &entries[first];
+	BuildEntry *end = begin + count;
+	uint32_t leftCount = 0;
+	BuildBin children[2];
+	if (task.depth < BVH_MIDPOINT_DEPTH && bestAxis >= 0) {
+		for (int i = 0; i < BVH_BINS; i++) children[(i <= bestBin) ? 0 : 1].add(bins[bestAxis * BVH_BINS + i]);
+		leftCount = children[0].count;
+		auto goesLeft = [&](const BuildEntry &entry) { return getBin(entry, bestAxis) <= bestBin; };
+		if (parallel) {
+			std::vector<std::array<BuildBin, 2>> chunkChildren(chunkCount);
+			// Each chunk counts its left entries, then copies every entry straight to its place in a sorted copy
+			std::vector<uint32_t> leftStarts(chunkCount, 0);
+			getTileScheduler().parallelFor(chunkCount, [&](size_t chunk) {
+				for (uint32_t i = first + uint32_t(chunk * BVH_CHUNK_SIZE); i < getChunkEnd(chunk); i++) leftStarts[chunk] += goesLeft(entries[i]) ? 1 : 0;
+			});
+			uint32_t leftTotal = 0;
+			for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+				uint32_t chunkLefts = leftStarts[chunk];
+				leftStarts[chunk] = leftTotal;
+				leftTotal += chunkLefts;
+			}
+			std::vector<BuildEntry> sorted(count);
+			getTileScheduler().parallelFor(chunkCount, [&](size_t chunk) {
+				uint32_t from = first + uint32_t(chunk * BVH_CHUNK_SIZE);
+				uint32_t leftPosition = leftStarts[chunk];
+				// Everything before the chunk that didn't go left went right
+				uint32_t rightPosition = leftCount + uint32_t(chunk * BVH_CHUNK_SIZE) - leftStarts[chunk];
+				for (uint32_t i = from; i < getChunkEnd(chunk); i++) {
+					bool left = goesLeft(entries[i]);
+					chunkChildren[chunk][left ? 0 : 1].addCentroid(entries[i]);
+					sorted[left ? leftPosition++ : rightPosition++] = entries[i];
+				}
+			});
+			getTileScheduler().parallelFor(chunkCount, [&](size_t chunk) {
+				uint32_t from = uint32_t(chunk * BVH_CHUNK_SIZE);
+				std::copy(sorted.begin() + from, sorted.begin() + (getChunkEnd(chunk) - first), begin + from);
+			});
+			for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+				children[0].add(chunkChildren[chunk][0]);
+				children[1].add(chunkChildren[chunk][1]);
+			}
+		} else {
+			BuildEntry *left = begin;
+			BuildEntry *right = end;
+			while (left < right) {
+				if (goesLeft(*left)) {
+					children[0].addCentroid(*left);
+					left++;
+				} else {
+					children[1].addCentroid(*left);
+					right--;
+					std::swap(*left, *right);
+				}
+			}
+		}
+	}
+	// No split was found (e.g. stacked centroids) or the tree is too deep, so fall back to an even split
+	if (leftCount == 0 || leftCount == count) {
+		int axis = 0;
+		if (extent.y > extent[axis]) axis = 1;
+		if (extent.z > extent[axis]) axis = 2;
+		leftCount = count / 2;
+		std::nth_element(begin, begin + leftCount, end, [&](const BuildEntry &a, const BuildEntry &b) {
+			return a.boundsMin[axis] + a.boundsMax[axis] < b.boundsMin[axis] + b.boundsMax[axis];
+		});
+		children[0] = measure(begin, leftCount);
+		children[1] = measure(begin + leftCount, count - leftCount);
+	}
+
+	uint32_t leftIndex = nodeCount.fetch_add(2);
+	node.leftOrFirst = leftIndex;
+	node.count = 0;
+	for (int child = 0; child < 2; child++) {
+		nodes[leftIndex + child].boundsMin = children[child].boundsMin;
+		nodes[leftIndex + child].boundsMax = children[child].boundsMax;
+		BuildTask childTask = {
+			leftIndex + child,
+			(child == 0) ? first : first + leftCount,
+			(child == 0) ? leftCount : count - leftCount,
+			task.depth + 1,
+			children[child].centroidMin,
+			children[child].centroidMax
+		};
+		if (tasks != nullptr && childTask.count < BVH_PARALLEL_SIZE) tasks->push_back(childTask);
+		else build(childTask, entries, nodeCount, tasks);
+	}
+}
+
+// Slab test, returns the entry distance or infinity if the ray misses the box before maxDistance
+static inline float intersectBounds(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance) {
+	glm::vec3 t0 = (boundsMin - origin) * inverseDirection;
+	glm::vec3 t1 = (boundsMax - origin) * inverseDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+	return (entry <= exit) ? entry : std::numeric_limits<float>::infinity();
+}
+
+bool BVH::isWide() const {
+	return !wideNodes.empty();
+}
+
+void BVH::setWideBounds(BVHWideNode &node, const glm::vec3 *childMins, const glm::vec3 *childMaxs) {
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+	for (int child = 0; child < BVH_WIDTH; child++) {
+		if (childMins[child].x > childMaxs[child].x) continue;
+		boundsMin = glm::min(boundsMin, childMins[child]);
+		boundsMax = glm::max(boundsMax, childMaxs[child]);
+	}
+	node.boundsMin = boundsMin;
+	for (int axis = 0; axis < 3; axis++) {
+		// Rounding can leave 255 steps just short of the far side, so steps are nudged up until they reach it
+		float step = (boundsMax[axis] - boundsMin[axis]) * (1.0f / 255.0f);
+		while (boundsMin[axis] + 255.0f * step < boundsMax[axis]) step = std::nextafter(step, std::numeric_limits<float>::infinity());
+		node.step[axis] = step;
+	}
+	for (int child = 0; child < BVH_WIDTH; child++) {
+		// Inverted, so the slab test misses it however the ray runs
+		if (childMins[child].x > childMaxs[child].x) {
+			for (int axis = 0; axis < 3; axis++) {
+				node.childBounds[axis][child] = 255;
+				node.childBounds[axis + 3][child] = 0;
+			}
+			continue;
+		}
+		for (int axis = 0; axis < 3; axis++) {
+			float step = node.step[axis];
+			int low = 0;
+			int high = 0;
+			if (step > 0.0f) {
+				low = std::max(int(floor((childMins[child][axis] - boundsMin[axis]) / step)), 0);
+				high = std::min(int(ceil((childMaxs[child][axis] - boundsMin[axis]) / step)), 255);
+				// Division rounds too, so check the boxes come out no smaller than they were
+				while (low > 0 && boundsMin[axis] + low * step > childMins[child][axis]) low--;
+				while (high < 255 && boundsMin[axis] + high * step < childMaxs[child][axis]) high++;
+			}
+			node.childBounds[axis][child] = uint8_t(low);
+			node.childBounds[axis + 3][child] = uint8_t(high);
+		}
+	}
+}
+
+void BVH::getWideChildBounds(const BVHWideNode &node, int child, glm::vec3 &min, glm::vec3 &max) const {
+	for (int axis = 0; axis < 3; axis++) {
+		min[axis] = node.boundsMin[axis] + node.childBounds[axis][child] * node.step[axis];
+		max[axis] = node.boundsMin[axis] + node.childBounds[axis + 3][child] * node.step[axis];
+	}
+}
+
+// Each wide node takes its binary node's children, then keeps opening up whichever of them that isn't a leaf
+// has the largest surface area, as that's the one rays are most likely to step into
+// Nodes are made in breadth first order, so children always come after their parent
+void BVH::makeWide() {
+	if (nodes.empty() || isWide()) return;
+	std::vector<uint32_t> sources(1, 0);
+	wideNodes.resize(1);
+	for (size_t i = 0; i < sources.size(); i++) {
+		const BVHNode &source = nodes[sources[i]];
+		uint32_t slots[BVH_WIDTH];
+		int slotCount = 0;
+		if (source.count > 0) slots[slotCount++] = sources[i];
+		else {
+			slots[slotCount++] = source.leftOrFirst;
+			slots[slotCount++] = source.leftOrFirst + 1;
+		}
+		while (slotCount < BVH_WIDTH) {
+			int largest = -1;
+			float largestArea = -1.0f;
+			for (int slot = 0; slot < slotCount; slot++) {
+				const BVHNode &node = nodes[slots[slot]];
+				if (node.count > 0) continue;
+				float area = getSurfaceArea(node.boundsMin, node.boundsMax);
+				if (area > largestArea) {
+					largest = slot;
+					largestArea = area;
+				}
+			}
+			if (largest < 0) break;
+			uint32_t left = nodes[slots[largest]].leftOrFirst;
+			slots[largest] = left;
+			slots[slotCount++] = left + 1;
+		}
+
+		BVHWideNode node;
+		glm::vec3 childMins[BVH_WIDTH];
+		glm::vec3 childMaxs[BVH_WIDTH];
+		for (int child = 0; child < BVH_WIDTH; child++) {
+			if (child >= slotCount) {
+				node.children[child] = 0;
+				node.counts[child] = BVH_EMPTY_CHILD;
+				childMins[child] = glm::vec3(std::numeric_limits<float>::max());
+				childMaxs[child] = glm::vec3(-std::numeric_limits<float>::max());
+				continue;
+			}
+			const BVHNode &childNode = nodes[slots[child]];
+			childMins[child] = childNode.boundsMin;
+			childMaxs[child] = childNode.boundsMax;
+			if (childNode.count > 0) {
+				node.children[child] = childNode.leftOrFirst;
+				node.counts[child] = uint8_t(childNode.count);
+				continue;
+			}
+			node.children[child] = uint32_t(wideNodes.size());
+			node.counts[child] = 0;
+			wideNodes.push_back(BVHWideNode());
+			sources.push_back(slots[child]);
+		}
+		setWideBounds(node, childMins, childMaxs);
+		wideNodes[i] = node;
+	}
+	nodes.clear();
+	nodes.shrink_to_fit();
+	wideNodes.shrink_to_fit();
+	cost = computeCost();
+	builtCost = cost;
+}
+
+// A ray set up for testing all of a wide node's children at once
+// Which of each child's bounds the ray meets first only depends on the direction, so it's picked once per ray
+struct BVHWideRay {
+	glm::vec3 origin;
+	glm::vec3 inverseDirection;
+	int nearRows[3];
+	int farRows[3];
+
+	BVHWideRay(const glm::vec3 &origin, const glm::vec3 &direction) : origin(origin) {
+		for (int axis = 0; axis < 3; axis++) {
+			float component = direction[axis];
+			if (std::abs(component) < BVH_MIN_DIRECTION) component = std::copysign(BVH_MIN_DIRECTION, component);
+			inverseDirection[axis] = 1.0f / component;
+			nearRows[axis] = (inverseDirection[axis] >= 0.0f) ? axis : axis + 3;
+			farRows[axis] = (inverseDirection[axis] >= 0.0f) ? axis + 3 : axis;
+		}
+	}
+};
+
+// Slab test against every child, giving each one's entry distance or infinity if the ray misses it before maxDistance
+// Kept to plain arithmetic on arrays so the compiler turns the loop into SIMD, a lane per child
+static inline void intersectChildren(const BVHWideNode &node, const BVHWideRay &ray, float maxDistance, float *distances) {
+	const uint8_t *nearX = node.childBounds[ray.nearRows[0]];
+	const uint8_t *nearY = node.childBounds[ray.nearRows[1]];
+	const uint8_t *nearZ = node.childBounds[ray.nearRows[2]];
+	const uint8_t *farX = node.childBounds[ray.farRows[0]];
+	const uint8_t *farY = node.childBounds[ray.farRows[1]];
+	const uint8_t *farZ = node.childBounds[ray.farRows[2]];
+	float baseX = node.boundsMin.x - ray.origin.x;
+	float baseY = node.boundsMin.y - ray.origin.y;
+	float baseZ = node.boundsMin.z - ray.origin.z;
+	float stepX = node.step.x;
+	float stepY = node.step.y;
+	float stepZ = node.step.z;
+	float inverseX = ray.inverseDirection.x;
+	float inverseY = ray.inverseDirection.y;
+	float inverseZ = ray.inverseDirection.z;
+	for (int child = 0; child < BVH_WIDTH; child++) {
+		float entryX = (baseX + nearX[child] * stepX) * inverseX;
+		float entryY = (baseY + nearY[child] * stepY) * inverseY;
+		float entryZ = (baseZ + nearZ[child] * stepZ) * inverseZ;
+		float exitX = (baseX + farX[child] * stepX) * inverseX;
+		float exitY = (baseY + farY[child] * stepY) * inverseY;
+		float exitZ = (baseZ + farZ[child] * stepZ) * inverseZ;
+		float entry = std::max(std::max(entryX, entryY), std::max(entryZ, 0.0f));
+		float exit = std::min(std::min(exitX, exitY), std::min(exitZ, maxDistance));
+		distances[child] = (entry <= exit) ? entry : std::numeric_limits<float>::infinity();
+	}
+}
+
+// Every child the ray hits goes on the stack farthest first along with its distance, leaves included,
+// so nearer leaves shorten the ray first and anything it has since been cut short of is skipped
+bool BVH::findClosestWide(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const {
+	BVHWideRay ray(origin, direction);
+	float closest = maxDistance;
+	bool found = false;
+	struct StackEntry {
+		uint32_t child;
+		uint32_t count;
+		float distance;
+	};
+	StackEntry stack[BVH_WIDE_STACK_SIZE];
+	size_t stackSize = 0;
+	glm::vec3 rootMin;
+	glm::vec3 rootMax;
+	getBounds(rootMin, rootMax);
+	float rootDistance = intersectBounds(rootMin, rootMax, origin, ray.inverseDirection, closest);
+	if (rootDistance != std::numeric_limits<float>::infinity()) stack[stackSize++] = {0, 0, rootDistance};
+	while (stackSize > 0) {
+		StackEntry current = stack[--stackSize];
+		if (current.distance >= closest) continue;
+		if (current.count > 0) {
+			for (uint32_t i = current.child; i < current.child + current.count; i++) {
+				if (intersectEntry(triangles[i], origin, direction, closest, hit)) {
+					closest = hit.distance;
+					found = true;
+				}
+			}
+			continue;
+		}
+		const BVHWideNode &node = wideNodes[current.child];
+		float distances[BVH_WIDTH];
+		intersectChildren(node, ray, closest, distances);
+		// Insertion sort into farthest first, there are only ever a few
+		int order[BVH_WIDTH];
+		int orderSize = 0;
+		for (int child = 0; child < BVH_WIDTH; child++) {
+			if (distances[child] == std::numeric_limits<float>::infinity() || node.counts[child] == BVH_EMPTY_CHILD) continue;
+			int i = orderSize++;
+			for (; i > 0 && distances[order[i - 1]] < distances[child]; i--) order[i] = order[i - 1];
+			order[i] = child;
+		}
+		for (int i = 0; i < orderSize; i++) stack[stackSize++] = {node.children[order[i]], node.counts[order[i]], distances[order[i]]};
+	}
+	return found;
+}
+
+bool BVH::occludedWide(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const {
+	BVHWideRay ray(origin, direction);
+	uint32_t stack[BVH_WIDE_STACK_SIZE];
+	size_t stackSize = 0;
+	glm::vec3 rootMin;
+	glm::vec3 rootMax;
+	getBounds(rootMin, rootMax);
+	if (intersectBounds(rootMin, rootMax, origin, ray.inverseDirection, maxDistance) == std::numeric_limits<float>::infinity()) return false;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const BVHWideNode &node = wideNodes[stack[--stackSize]];
+		float distances[BVH_WIDTH];
+		intersectChildren(node, ray, maxDistance, distances);
+		for (int child = 0; child < BVH_WIDTH; child++) {
+			if (distances[child] == std::numeric_limits<float>::infinity() || node.counts[child] == BVH_EMPTY_CHILD) continue;
+			if (node.counts[child] == 0) {
+				stack[stackSize++] = node.children[child];
+				continue;
+			}
+			for (uint32_t i = node.children[child]; i < node.children[child] + node.counts[child]; i++) {
+				if (occludesEntry(triangles[i], origin, direction, maxDistance)) return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Moller-Trumbore, only accepts hits closer than maxDistance
+bool BVH::intersectTriangle(const Triangle &triangle, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const {
+	glm::vec3 p = glm::cross(direction, triangle.edge2);
+	float determinant = glm::dot(triangle.edge1, p);
+	if (std::abs(determinant) < 1e-9f) return false;
+	float inverseDeterminant = 1.0f / determinant;
+	glm::vec3 s = origin - triangle.vertex0;
+	float u = glm::dot(s, p) * inverseDeterminant;
+	if (u < 0.0f || u > 1.0f) return false;
+	glm::vec3 q = glm::cross(s, triangle.edge1);
+	float v = glm::dot(direction, q) * inverseDeterminant;
+	if (v < 0.0f || u + v > 1.0f) return false;
+	float t = glm::dot(triangle.edge2, q) * inverseDeterminant;
+	if (t < 0.0f || t >= maxDistance) return false;
+	hit.distance = t;
+	hit.u = u;
+	hit.v = v;
+	hit.triangleIndex = triangle.index;
+	hit.primitiveIndex = -1;
+	hit.instanceIndex = -1;
+	return true;
+}
+
+bool BVH::intersectPrimitive(uint32_t index, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const {
+	float distance;
+	if (!primitives[index].intersect(origin, direction, maxDistance, distance)) return false;
+	hit.distance = distance;
+	hit.u = 0.0f;
+	hit.v = 0.0f;
+	hit.triangleIndex = 0;
+	hit.primitiveIndex = int32_t(index);
+	hit.instanceIndex = -1;
+	return true;
+}
+
+// The ray is taken into the mesh's space without normalising its direction, so distances there match the world's
+bool BVH::intersectInstance(uint32_t index, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const {
+	const BVHInstance &instance = instances[index];
+	glm::vec3 meshOrigin = glm::vec3(instance.inverseTransform * glm::vec4(origin, 1.0f));
+	glm::vec3 meshDirection = glm::mat3(instance.inverseTransform) * direction;
+	if (!instance.mesh->bvh.findClosest(meshOrigin, meshDirection, maxDistance, hit)) return false;
+	hit.instanceIndex = int32_t(index);
+	return true;
+}
+
+bool BVH::intersectEntry(const Triangle &entry, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const {
+	if (entry.index & BVH_PRIMITIVE_BIT) return intersectPrimitive(entry.index & BVH_INDEX_MASK, origin, direction, maxDistance, hit);
+	if (entry.index & BVH_INSTANCE_BIT) return intersectInstance(entry.index & BVH_INDEX_MASK, origin, direction, maxDistance, hit);
+	return intersectTriangle(entry, origin, direction, maxDistance, hit);
+}
+
+// Instances are asked for any hit at all rather than the closest
+bool BVH::occludesEntry(const Triangle &entry, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const {
+	if (entry.index & BVH_INSTANCE_BIT) {
+		const BVHInstance &instance = instances[entry.index & BVH_INDEX_MASK];
+		glm::vec3 meshOrigin = glm::vec3(instance.inverseTransform * glm::vec4(origin, 1.0f));
+		glm::vec3 meshDirection = glm::mat3(instance.inverseTransform) * direction;
+		return instance.mesh->bvh.occluded(meshOrigin, meshDirection, maxDistance);
+	}
+	BVHHit hit;
+	return intersectEntry(entry, origin, direction, maxDistance, hit);
+}
+
+bool BVH::intersect(const glm::vec3 &origin, const glm::vec3 &direction, BVHHit &hit) const {
+	if (!findClosest(origin, direction, std::numeric_limits<float>::infinity(), hit)) return false;
+	if (hit.primitiveIndex >= 0) hit.normal = primitives[hit.primitiveIndex].getNormal(origin + hit.distance * direction);
+	if (hit.instanceIndex >= 0) {
+		const BVHInstance &instance = instances[hit.instanceIndex];
+		hit.normal = glm::normalize(instance.normalTransform * instance.mesh->triangles[hit.triangleIndex].normal);
+	}
+	return true;
+}
+
+// Closest hit along the ray, visiting the nearer child first so far subtrees get culled
+bool BVH::findClosest(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const {
+	if (nodes.empty() && wideNodes.empty() && unboundedPrimitives.empty()) return false;
+	glm::vec3 inverseDirection = 1.0f / direction;
+	float closest = maxDistance;
+	bool found = false;
+
+	// Tested first so that whatever they hit culls the tree
+	for (size_t i = 0; i < unboundedPrimitives.size(); i++) {
+		if (intersectPrimitive(unboundedPrimitives[i], origin, direction, closest, hit)) {
+			closest = hit.distance;
+			found = true;
+		}
+	}
+	if (isWide()) return findClosestWide(origin, direction, closest, hit) || found;
+
+	uint32_t stack[BVH_STACK_SIZE];
+	size_t stackSize = 0;
+	if (!nodes.empty() && intersectBounds(nodes[0].boundsMin, nodes[0].boundsMax, origin, inverseDirection, closest) != std::numeric_limits<float>::infinity()) {
+		stack[stackSize++] = 0;
+	}
+	while (stackSize > 0) {
+		const BVHNode &node = nodes[stack[--stackSize]];
+		if (node.count > 0) {
+			for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+				if (intersectEntry(triangles[i], origin, direction, closest, hit)) {
+					closest = hit.distance;
+					found = true;
+				}
+			}
+			continue;
+		}
+		uint32_t nearIndex = node.leftOrFirst;
+		uint32_t farIndex = node.leftOrFirst + 1;
+		float nearDistance = intersectBounds(nodes[nearIndex].boundsMin, nodes[nearIndex].boundsMax, origin, inverseDirection, closest);
+		float farDistance = intersectBounds(nodes[farIndex].boundsMin, nodes[farIndex].boundsMax, origin, inverseDirection, closest);
+		if (farDistance < nearDistance) {
+			std::swap(nearIndex, farIndex);
+			std::swap(nearDistance, farDistance);
+		}
+		if (farDistance != std::numeric_limits<float>::infinity()) stack[stackSize++] = farIndex;
+		if (nearDistance != std::numeric_limits<float>::infinity()) stack[stackSize++] = nearIndex;
+	}
+	return found;
+}
+
+// Any hit before maxDistance, stopping at the first one since shadow rays don't care which
+bool BVH::occluded(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const {
+	glm::vec3 inverseDirection = 1.0f / direction;
+	BVHHit hit;
+	for (size_t i = 0; i < unboundedPrimitives.size(); i++) {
+		if (intersectPrimitive(unboundedPrimitives[i], origin, direction, maxDistance, hit)) return true;
+	}
+	if (isWide()) return occludedWide(origin, direction, maxDistance);
+	if (nodes.empty()) return false;
+
+	uint32_t stack[BVH_STACK_SIZE];
+	size_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const BVHNode &node = nodes[stack[--stackSize]];
+		if (intersectBounds(node.boundsMin, node.boundsMax, origin, inverseDirection, maxDistance) == std::numeric_limits<float>::infinity()) continue;
+		if (node.count > 0) {
+			for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+				if (occludesEntry(triangles[i], origin, direction, maxDistance)) return true;
+			}
+			continue;
+		}
+		stack[stackSize++] = node.leftOrFirst + 1;
+		stack[stackSize++] = node.leftOrFirst;
+	}
+	return false;
+}
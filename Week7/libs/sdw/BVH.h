@@ -0,0 +1,182 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "ModelTriangle.h"
+#include "Primitive.h"
+
+// Interior nodes store the index of their left child (the right child follows it),
+// leaves store the first of count consecutive entries in the BVH's triangle order, which may be primitives too
+struct BVHNode {
+	glm::vec3 boundsMin;
+	uint32_t leftOrFirst;
+	glm::vec3 boundsMax;
+	uint32_t count;
+};
+
+// Children per node of a wide BVH, 4 or 8 to fill the SIMD lanes that test them
+#define BVH_WIDTH 8
+
+// A node of a wide BVH, whose box runs from boundsMin to boundsMin + 255 * step
+// Children's boxes are kept as whole steps across that box, rounded outwards so they only ever grow,
+// and laid out a coordinate at a time so all the children can be tested together
+struct BVHWideNode {
+	glm::vec3 boundsMin;
+	glm::vec3 step;
+	// The children's minimum x, y and z, then their maximum x, y and z
+	uint8_t childBounds[6][BVH_WIDTH];
+	// The child's wide node, or the first of its entries if it is a leaf
+	uint32_t children[BVH_WIDTH];
+	// 0 for a wide node, how many entries a leaf holds, or BVH_EMPTY_CHILD for an unused slot
+	uint8_t counts[BVH_WIDTH];
+};
+
+struct BVHHit {
+	float distance;
+	float u;
+	float v;
+	// Into the instance's mesh when instanceIndex is set
+	size_t triangleIndex;
+	// Index of the primitive hit instead of a triangle, -1 if it was a triangle
+	int32_t primitiveIndex;
+	// Index of the instance whose triangle was hit, -1 if the triangle wasn't part of one
+	int32_t instanceIndex;
+	// Only filled in for primitives and instances, in world space, other triangles have their own
+	glm::vec3 normal;
+};
+
+struct BVHMesh;
+
+// A copy of a mesh placed in the scene by a transform from the mesh's space into the world's
+// Copies share the mesh's triangles and BVH, so they cost memory and build time only once however many there are
+struct BVHInstance {
+	std::shared_ptr<const BVHMesh> mesh;
+	glm::mat4 transform;
+	glm::mat4 inverseTransform;
+	// Takes normals into world space, the inverse transpose of the transform
+	glm::mat3 normalTransform;
+
+	BVHInstance(std::shared_ptr<const BVHMesh> mesh, const glm::mat4 &transform);
+
+	// World space box around the transformed mesh
+	void getBounds(glm::vec3 &min, glm::vec3 &max) const;
+};
+
+// Bounding volume hierarchy over a fixed set of triangles, primitives and instances for closest-hit and shadow ray queries
+// Primitives with no bounds, like planes, are tested against every ray instead
+// Instances are leaves of this top-level tree, rays that reach one carry on down its mesh's own tree in the mesh's space
+// Ray directions must be normalised so that distances come back in world units
+class BVH {
+public:
+	BVH();
+	explicit BVH(
+		const std::vector<ModelTriangle> &triangles,
+		const std::vector<Primitive> &primitives = std::vector<Primitive>(),
+		const std::vector<BVHInstance> &instances = std::vector<BVHInstance>());
+
+	bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, BVHHit &hit) const;
+	bool occluded(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const;
+	size_t nodeCount() const;
+	// Moves the triangles to where they are now, given in the same number and order as the tree was built with
+	// Keeps the tree's shape and only updates its bounds, which is far cheaper than rebuilding
+	// but the tree gets worse the further the triangles move from where it was built
+	void refit(const std::vector<ModelTriangle> &triangles);
+	// Surface area heuristic cost, the expected work to trace a ray through the tree relative to its root
+	float getCost() const;
+	// How many times the cost has grown through refitting, 1 when the tree has just been built
+	float getDegradation() const;
+	// Box around everything in the tree, left inverted (min above max) if it is empty
+	void getBounds(glm::vec3 &min, glm::vec3 &max) const;
+	const Primitive &getPrimitive(size_t index) const;
+	const BVHInstance &getInstance(size_t index) const;
+	// Collapses the binary tree into a BVH_WIDTH wide one and frees the binary nodes, everything else works as before
+	// Rays visit far fewer nodes and test each one's children all at once, and the nodes take about half the memory
+	void makeWide();
+	bool isWide() const;
+	// Bytes taken up by the nodes
+	size_t getNodeMemory() const;
+
+private:
+	// Just what intersection needs, laid out in traversal order
+	// Primitives and instances are stored with their bounds as vertex0 and vertex0 + edge1,
+	// and index marked by BVH_PRIMITIVE_BIT or BVH_INSTANCE_BIT
+	struct Triangle {
+		glm::vec3 vertex0;
+		glm::vec3 edge1;
+		glm::vec3 edge2;
+		uint32_t index;
+	};
+
+	std::vector<BVHNode> nodes;
+	// Only once the tree has been made wide, nodes is empty then
+	std::vector<BVHWideNode> wideNodes;
+	std::vector<Triangle> triangles;
+	std::vector<Primitive> primitives;
+	std::vector<uint32_t> unboundedPrimitives;
+	std::vector<BVHInstance> instances;
+	float cost;
+	float builtCost;
+
+	// What the build sorts in place of the triangles, being smaller and holding everything it looks at
+	// The centroid used is the centre of the box
+	struct BuildEntry {
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		uint32_t triangle;
+	};
+
+	// Box around some entries and around their centroids, and how many there are
+	struct BuildBin {
+		glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+		glm::vec3 centroidMin = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 centroidMax = glm::vec3(-std::numeric_limits<float>::max());
+		uint32_t count = 0;
+
+		// Only grows the box and count, as binning doesn't need the centroids
+		void add(const BuildEntry &entry);
+		void addCentroid(const BuildEntry &entry);
+		void add(const BuildBin &other);
+	};
+
+	// A subtree left for one thread to build once the top of the tree has been split
+	struct BuildTask {
+		uint32_t nodeIndex;
+		uint32_t first;
+		uint32_t count;
+		int depth;
+		glm::vec3 centroidMin;
+		glm::vec3 centroidMax;
+	};
+
+	static void getEntryBounds(const Triangle &entry, glm::vec3 &min, glm::vec3 &max);
+	static BuildBin measure(const BuildEntry *entries, uint32_t count);
+	// The node's bounds must already be set, and its children's are set before they are built
+	// Hands subtrees smaller than BVH_PARALLEL_SIZE to tasks when given it, otherwise builds the whole subtree
+	void build(const BuildTask &task, std::vector<BuildEntry> &entries, std::atomic<uint32_t> &nodeCount, std::vector<BuildTask> *tasks);
+	float computeCost() const;
+	// Fits the node's box around its children's and quantises theirs, children with inverted boxes are left empty
+	static void setWideBounds(BVHWideNode &node, const glm::vec3 *childMins, const glm::vec3 *childMaxs);
+	void getWideChildBounds(const BVHWideNode &node, int child, glm::vec3 &min, glm::vec3 &max) const;
+	bool intersectTriangle(const Triangle &triangle, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const;
+	bool intersectPrimitive(uint32_t index, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const;
+	bool intersectInstance(uint32_t index, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const;
+	bool intersectEntry(const Triangle &entry, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const;
+	bool occludesEntry(const Triangle &entry, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const;
+	// Directions needn't be normalised here, distances come back in multiples of the direction's length
+	bool findClosest(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const;
+	bool findClosestWide(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, BVHHit &hit) const;
+	bool occludedWide(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const;
+};
+
+// Triangles in their own space with a BVH over them, for instances to share
+struct BVHMesh {
+	std::vector<ModelTriangle> triangles;
+	BVH bvh;
+
+	explicit BVHMesh(const std::vector<ModelTriangle> &triangles);
+};
@@ -0,0 +1,52 @@
+#include <cmath>
+#include "CameraEnvironment.h"
+
+void CameraEnvironment::rotateX(float theta) {
+	glm::mat3 rotationX = glm::mat3(
+		1.0, 0.0, 0.0, 							// first column
+		0.0, std::cos(theta), std::sin(theta), 	// second column
+		0.0, -std::sin(theta), std::cos(theta) 	// third column
+	);
+	rotation = rotation * rotationX;
+}
+
+void CameraEnvironment::rotateY(float theta) {
+	glm::mat3 rotationY = glm::mat3(
+		std::cos(theta), 0.0, -std::sin(theta), 	// first column
+		0.0, 1.0, 0.0, 								// second column
+		std::sin(theta), 0.0, std::cos(theta) 		// third column
+	);
+	rotation = rotation * rotationY;
+}
+
+void CameraEnvironment::lookAt(glm::vec3 point) {
+	glm::vec3 forward = glm::normalize(position - point);
+	glm::vec3 vertical = glm::vec3(0.0, 1.0, 0.0);
+	glm::vec3 right = glm::normalize(glm::cross(vertical, forward));
+	glm::vec3 up = glm::cross(forward, right);
+
+	rotation = glm::mat3(
+		right,
+		up,
+		forward
+	);
+}
+
+float getPlaneScaling(const FrameBuffer &frameBuffer) {
+	return PLANE_SCALING * float(frameBuffer.height) / PLANE_SCALING_HEIGHT;
+}
+
+CanvasPoint vertexToImagePlane(glm::vec3 vertex, const CameraEnvironment &cameraEnv, const FrameBuffer &frameBuffer) {
+	// The inverse of the ray tracers' camera rotation, so rasterised and ray traced frames line up whichever way the camera faces
+	glm::vec3 orientedDist = glm::transpose(cameraEnv.rotation) * (vertex - cameraEnv.position);
+
+	float planeScaling = getPlaneScaling(frameBuffer);
+	float u = (cameraEnv.focalLength / -orientedDist.z) * orientedDist.x * planeScaling + frameBuffer.width / 2;
+
+	// negative since y of zero at top of page
+	float v = -((cameraEnv.focalLength / -orientedDist.z) * orientedDist.y * planeScaling) + frameBuffer.height / 2;
+
+	float depth = 1 / (std::abs(orientedDist.z));
+
+	return CanvasPoint(u, v, depth);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "CanvasPoint.h"
+#include "FrameBuffer.h"
+
+// Pixels per unit of image plane in a frame PLANE_SCALING_HEIGHT pixels tall - scaled with the height so framing stays the same
+#define PLANE_SCALING 700.0f
+#define PLANE_SCALING_HEIGHT 700
+
+class CameraEnvironment {
+public:
+	glm::vec3 position;
+	glm::mat3 rotation;
+	float focalLength;
+
+	void rotateX(float theta);
+	void rotateY(float theta);
+	void lookAt(glm::vec3 point);
+};
+
+float getPlaneScaling(const FrameBuffer &frameBuffer);
+// Where vertex lands in frameBuffer, with 1 / z as its depth
+CanvasPoint vertexToImagePlane(glm::vec3 vertex, const CameraEnvironment &cameraEnv, const FrameBuffer &frameBuffer);
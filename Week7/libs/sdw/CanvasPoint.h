@@ -1,6 +1,7 @@
 #pragma once
 
 #include "TexturePoint.h"
+#include <glm/glm.hpp>
 #include <iostream>
 
 struct CanvasPoint {
@@ -9,6 +10,10 @@ struct CanvasPoint {
 	float depth{};
 	float brightness{};
 	TexturePoint texturePoint{};
+	// Lightmap atlas position multiplied by depth, so it interpolates correctly under perspective
+	TexturePoint lightmapPoint{};
+	// Vertex normal multiplied by depth, so it interpolates correctly under perspective and normalises back to its direction
+	glm::vec3 normal{};
 
 	CanvasPoint();
 	CanvasPoint(float xPos, float yPos);
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cmath>
+#include "Denoiser.h"
+#include "TileScheduler.h"
+#include "Utils.h"
+
+// e^-x for x >= 0 as (1 - x / 16)^16, close enough for a filter weight and it vectorises
+static inline float fastNegativeExp(float x) {
+	float base = std::max(1.0f - x * (1.0f / 16.0f), 0.0f);
+	base *= base;
+	base *= base;
+	base *= base;
+	base *= base;
+	return base;
+}
+
+void Denoiser::resize(size_t w, size_t h) {
+	if (w == width && h == height) return;
+	width = w;
+	height = h;
+	stride = alignedStride(w);
+	for (int c = 0; c < 3; c++) {
+		light[c] = AlignedBuffer<float>(stride * h);
+		filtered[c] = AlignedBuffer<float>(stride * h);
+		normal[c] = AlignedBuffer<float>(stride * h);
+		albedo[c] = AlignedBuffer<float>(stride * h);
+	}
+	depth = AlignedBuffer<float>(stride * h);
+	inverseDepthTolerance = AlignedBuffer<float>(stride * h);
+}
+
+void Denoiser::setGuides(size_t x, size_t y, glm::vec3 surfaceNormal, float distance, glm::vec3 surfaceAlbedo) {
+	size_t index = y * stride + x;
+	for (int c = 0; c < 3; c++) {
+		normal[c][index] = surfaceNormal[c];
+		albedo[c][index] = surfaceAlbedo[c];
+	}
+	depth[index] = distance;
+}
+
+void Denoiser::clearGuides(size_t x, size_t y) {
+	setGuides(x, y, glm::vec3(0.0), 0.0f, glm::vec3(0.0));
+}
+
+void Denoiser::filter() {
+	size_t blockCount = (height + DENOISE_ROWS_PER_TASK - 1) / DENOISE_ROWS_PER_TASK;
+	// Saves a division per tap
+	for (size_t i = 0; i < stride * height; i++) inverseDepthTolerance[i] = 1.0f / (DENOISE_DEPTH_SIGMA * depth[i] + 1e-6f);
+	for (int i = 0; i < DENOISE_ITERATIONS; i++) {
+		int step = 1 << i;
+		float lightSigma = DENOISE_LIGHT_SIGMA / step;
+		float lightScale = 1.0f / (lightSigma * lightSigma);
+		getTileScheduler().parallelFor(blockCount, [&](size_t block) {
+			size_t fromY = block * DENOISE_ROWS_PER_TASK;
+			size_t toY = std::min(fromY + DENOISE_ROWS_PER_TASK, height);
+			for (size_t y = fromY; y < toY; y++) filterRow(int(y), step, lightScale);
+		});
+		for (int c = 0; c < 3; c++) std::swap(light[c], filtered[c]);
+	}
+}
+
+void Denoiser::filterRow(int y, int step, float lightScale) {
+	const float kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+	int w = int(width);
+	size_t row = y * stride;
+	const float *red = light[0].data;
+	const float *green = light[1].data;
+	const float *blue = light[2].data;
+	const float *normalX = normal[0].data;
+	const float *normalY = normal[1].data;
+	const float *normalZ = normal[2].data;
+	const float *distance = depth.data;
+	const float *depthTolerance = inverseDepthTolerance.data;
+	const float *albedoRed = albedo[0].data;
+	const float *albedoGreen = albedo[1].data;
+	const float *albedoBlue = albedo[2].data;
+	for (int chunkX = 0; chunkX < w; chunkX += DENOISE_CHUNK_SIZE) {
+		int chunkEnd = std::min(chunkX + DENOISE_CHUNK_SIZE, w);
+		alignas(CACHE_LINE_SIZE) float sumRed[DENOISE_CHUNK_SIZE] = {};
+		alignas(CACHE_LINE_SIZE) float sumGreen[DENOISE_CHUNK_SIZE] = {};
+		alignas(CACHE_LINE_SIZE) float sumBlue[DENOISE_CHUNK_SIZE] = {};
+		alignas(CACHE_LINE_SIZE) float sumWeight[DENOISE_CHUNK_SIZE] = {};
+
+		for (int ky = -2; ky <= 2; ky++) {
+			int sourceY = y + ky * step;
+			if (sourceY < 0 || sourceY >= int(height)) continue;
+			size_t sourceRow = sourceY * stride;
+			for (int kx = -2; kx <= 2; kx++) {
+				int offset = kx * step;
+				// Taps that fall off the image are left out, the weights are normalised anyway
+				int fromX = std::max(chunkX, -offset);
+				int toX = std::min(chunkEnd, w - offset);
+				float tapWeight = kernel[ky + 2] * kernel[kx + 2];
+				// Depth may differ more the further away the tap is, the centre tap doesn't differ at all
+				int ring = std::max(std::abs(ky), std::abs(kx));
+				float depthScale = (ring > 0) ? 1.0f / (step * ring) : 0.0f;
+				float albedoScale = 1.0f / DENOISE_ALBEDO_SIGMA;
+				for (int x = fromX; x < toX; x++) {
+					size_t centre = row + x;
+					size_t tap = sourceRow + x + offset;
+					float normalCosine = normalX[centre] * normalX[tap] + normalY[centre] * normalY[tap] + normalZ[centre] * normalZ[tap];
+					float normalWeight = pow256(std::max(normalCosine, 0.0f));
+					float depthWeight = fastNegativeExp(std::abs(distance[centre] - distance[tap]) * depthTolerance[centre] * depthScale);
+					float albedoDifference = std::abs(albedoRed[centre] - albedoRed[tap]) + std::abs(albedoGreen[centre] - albedoGreen[tap]) + std::abs(albedoBlue[centre] - albedoBlue[tap]);
+					float redDifference = red[centre] - red[tap];
+					float greenDifference = green[centre] - green[tap];
+					float blueDifference = blue[centre] - blue[tap];
+					float lightDifference = redDifference * redDifference + greenDifference * greenDifference + blueDifference * blueDifference;
+					float weight = tapWeight * normalWeight * depthWeight * fastNegativeExp(albedoDifference * albedoScale + lightDifference * lightScale);
+					sumRed[x - chunkX] += weight * red[tap];
+					sumGreen[x - chunkX] += weight * green[tap];
+					sumBlue[x - chunkX] += weight * blue[tap];
+					sumWeight[x - chunkX] += weight;
+				}
+			}
+		}
+
+		for (int x = chunkX; x < chunkEnd; x++) {
+			size_t index = row + x;
+			// Only pixels that hit nothing have no weight, even for themselves
+			bool weighted = sumWeight[x - chunkX] > 0.0f;
+			float inverseWeight = weighted ? 1.0f / sumWeight[x - chunkX] : 0.0f;
+			filtered[0][index] = weighted ? sumRed[x - chunkX] * inverseWeight : red[index];
+			filtered[1][index] = weighted ? sumGreen[x - chunkX] * inverseWeight : green[index];
+			filtered[2][index] = weighted ? sumBlue[x - chunkX] * inverseWeight : blue[index];
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "FrameBuffer.h"
+
+// Each a-trous pass spreads the same 5x5 kernel twice as wide as the last, so 5 passes reach 31 pixels each way with 125 taps
+#define DENOISE_ITERATIONS 5
+// How far each guide can differ before neighbours stop counting, smaller keeps edges sharper
+// Depth is relative to the pixel's own depth per pixel of filter step, the light difference shrinks by half each pass
+#define DENOISE_DEPTH_SIGMA 0.01f
+#define DENOISE_ALBEDO_SIGMA 0.1f
+#define DENOISE_LIGHT_SIGMA 1.0f
+// Albedo channels are divided out with at least this, so black surfaces don't blow up
+#define DENOISE_MIN_ALBEDO 0.05f
+#define DENOISE_ROWS_PER_TASK 8
+#define DENOISE_CHUNK_SIZE 64
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al.) for noisy ray and path traced frames
+// The renderer fills in the light reaching each pixel, with the surface colour divided out so texture detail
+// is never blurred, along with the normal, depth and albedo of what the pixel sees first to guide the filter
+// Every plane is separate and row-major, with a shared cache line aligned stride, so the filter loops vectorise
+class Denoiser {
+public:
+	size_t width = 0;
+	size_t height = 0;
+	size_t stride = 0;
+	AlignedBuffer<float> light[3];
+	AlignedBuffer<float> normal[3];
+	// Distance along the camera ray, 0 where nothing was hit
+	AlignedBuffer<float> depth;
+	AlignedBuffer<float> albedo[3];
+
+	// Planes are reallocated, and their contents lost, only when the size changes
+	void resize(size_t w, size_t h);
+
+	void setGuides(size_t x, size_t y, glm::vec3 surfaceNormal, float distance, glm::vec3 surfaceAlbedo);
+	// Pixels that hit nothing have a zero normal, so they never share light with anything
+	void clearGuides(size_t x, size_t y);
+
+	// Replaces the light planes with their filtered values, rows are shared out over the tile scheduler
+	void filter();
+
+private:
+	AlignedBuffer<float> filtered[3];
+	AlignedBuffer<float> inverseDepthTolerance;
+
+	// One pass over row y, DENOISE_CHUNK_SIZE pixels at a time so the sums stay in registers and cache
+	void filterRow(int y, int step, float lightScale);
+};
@@ -1,10 +1,20 @@
-#include <array>
+#include <algorithm>
+#include <cstring>
 #include "DrawingWindow.h"
 // On some platforms you may need to include <cstring> (if you compiler can't find memset !)
 
-DrawingWindow::DrawingWindow() {}
+DrawingWindow::DrawingWindow() : frameReady(false), frameReadyEvent(0), presentRequested(false), quitRequested(false) {}
 
-DrawingWindow::DrawingWindow(int w, int h, bool fullscreen) : width(w), height(h), pixelBuffer(w * h) {
+DrawingWindow::DrawingWindow(int w, int h, bool fullscreen) :
+		width(w),
+		height(h),
+		pixelBuffer(w, h),
+		frontBuffer(pixelBuffer.stride * h),
+		frameReady(false),
+		pendingTiles(pixelBuffer.tilesX * pixelBuffer.tilesY, 0),
+		presentRequested(true),
+		quitRequested(false) {
+	std::fill(frontBuffer.data, frontBuffer.data + frontBuffer.size, 0);
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0) printMessageAndQuit("Could not initialise SDL: ", SDL_GetError());
 	uint32_t flags = SDL_WINDOW_OPENGL;
 	if (fullscreen) flags |= SDL_WINDOW_FULLSCREEN_DESKTOP;
@@ -20,74 +30,186 @@ DrawingWindow::DrawingWindow(int w, int h, bool fullscreen) : width(w), height(h
 	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
 	SDL_RenderSetLogicalSize(renderer, width, height);
 	int PIXELFORMAT = SDL_PIXELFORMAT_ARGB8888;
-	texture = SDL_CreateTexture(renderer, PIXELFORMAT, SDL_TEXTUREACCESS_STATIC, width, height);
+	// Streaming so that only the regions which changed need to be written each frame
+	texture = SDL_CreateTexture(renderer, PIXELFORMAT, SDL_TEXTUREACCESS_STREAMING, width, height);
 	if (!texture) printMessageAndQuit("Could not allocate texture: ", SDL_GetError());
+	// Pushed by swapBuffers so a thread blocked in waitForInputEvents wakes up to present the new frame
+	frameReadyEvent = SDL_RegisterEvents(1);
 }
 
+// Presents the most recently completed frame - call from the thread that created the window
+// Only tiles that changed are uploaded, and nothing is presented if no tile changed
 void DrawingWindow::renderFrame() {
-	SDL_UpdateTexture(texture, nullptr, pixelBuffer.data(), width * sizeof(uint32_t));
+	{
+		std::lock_guard<std::mutex> lock(frontBufferMutex);
+		if (frameReady) {
+			size_t tilesX = pixelBuffer.tilesX;
+			for (size_t tileY = 0; tileY < pixelBuffer.tilesY; tileY++) {
+				// Uploads horizontal runs of pending tiles as one rectangle each
+				size_t tileX = 0;
+				while (tileX < tilesX) {
+					if (!pendingTiles[tileY * tilesX + tileX]) {
+						tileX++;
+						continue;
+					}
+					size_t runStart = tileX;
+					while (tileX < tilesX && pendingTiles[tileY * tilesX + tileX]) {
+						pendingTiles[tileY * tilesX + tileX] = 0;
+						tileX++;
+					}
+					uploadTiles(tileY, runStart, tileX);
+				}
+			}
+			frameReady = false;
+			presentRequested = true;
+		}
+	}
+	if (!presentRequested) return;
 	SDL_RenderClear(renderer);
 	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
 	SDL_RenderPresent(renderer);
+	presentRequested = false;
+}
+
+void DrawingWindow::uploadTiles(size_t tileY, size_t fromTileX, size_t toTileX) {
+	size_t fromX = fromTileX * DIRTY_TILE_SIZE;
+	size_t fromY = tileY * DIRTY_TILE_SIZE;
+	size_t toX = std::min(toTileX * DIRTY_TILE_SIZE, width);
+	size_t toY = std::min(fromY + DIRTY_TILE_SIZE, height);
+	SDL_Rect rect = {int(fromX), int(fromY), int(toX - fromX), int(toY - fromY)};
+
+	void *texturePixels;
+	int pitch;
+	if (SDL_LockTexture(texture, &rect, &texturePixels, &pitch) != 0) return;
+	for (size_t y = fromY; y < toY; y++) {
+		uint8_t *textureRow = static_cast<uint8_t *>(texturePixels) + (y - fromY) * pitch;
+		std::memcpy(textureRow, &frontBuffer[y * pixelBuffer.stride + fromX], (toX - fromX) * sizeof(uint32_t));
+	}
+	SDL_UnlockTexture(texture);
+}
+
+// Copies a written tile into the front buffer, returns false if its contents didn't actually change
+bool DrawingWindow::copyTileIfChanged(size_t tileX, size_t tileY) {
+	size_t fromX = tileX * DIRTY_TILE_SIZE;
+	size_t fromY = tileY * DIRTY_TILE_SIZE;
+	size_t rowBytes = (std::min(fromX + DIRTY_TILE_SIZE, width) - fromX) * sizeof(uint32_t);
+	size_t toY = std::min(fromY + DIRTY_TILE_SIZE, height);
+
+	bool changed = false;
+	for (size_t y = fromY; y < toY; y++) {
+		const uint32_t *backRow = static_cast<const FrameBuffer &>(pixelBuffer).getRow(y) + fromX;
+		uint32_t *frontRow = &frontBuffer[y * pixelBuffer.stride + fromX];
+		if (std::memcmp(backRow, frontRow, rowBytes) != 0) {
+			std::memcpy(frontRow, backRow, rowBytes);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+// Publishes the back buffer as the latest completed frame - safe to call from a render thread
+// The window's thread is only woken if some tile's contents differ from the previous frame
+void DrawingWindow::swapBuffers() {
+	bool anyChanged = false;
+	bool wakeUpPending;
+	{
+		std::lock_guard<std::mutex> lock(frontBufferMutex);
+		wakeUpPending = frameReady;
+		// Copy rather than swap so the back buffer keeps its contents for the next frame
+		std::vector<uint8_t> &dirtyTiles = pixelBuffer.dirtyTiles;
+		for (size_t tileY = 0; tileY < pixelBuffer.tilesY; tileY++) {
+			for (size_t tileX = 0; tileX < pixelBuffer.tilesX; tileX++) {
+				size_t tile = tileY * pixelBuffer.tilesX + tileX;
+				if (!dirtyTiles[tile]) continue;
+				dirtyTiles[tile] = 0;
+				if (copyTileIfChanged(tileX, tileY)) {
+					pendingTiles[tile] = 1;
+					anyChanged = true;
+				}
+			}
+		}
+		frameReady = frameReady || anyChanged;
+	}
+	// An earlier frame that hasn't been presented yet already has a wake up event queued
+	if (!anyChanged || wakeUpPending) return;
+	SDL_Event wakeEvent;
+	SDL_memset(&wakeEvent, 0, sizeof(wakeEvent));
+	wakeEvent.type = frameReadyEvent;
+	SDL_PushEvent(&wakeEvent);
 }
 
 void DrawingWindow::saveBMP(const std::string &filename) const {
-	auto surface = SDL_CreateRGBSurfaceFrom((void *) pixelBuffer.data(), width, height, 32,
-	                                        width * sizeof(uint32_t),
+	std::lock_guard<std::mutex> lock(frontBufferMutex);
+	auto surface = SDL_CreateRGBSurfaceFrom((void *) frontBuffer.data, width, height, 32,
+	                                        pixelBuffer.stride * sizeof(uint32_t),
 	                                        0xFF << 16, 0xFF << 8, 0xFF << 0, 0xFF << 24);
 	SDL_SaveBMP(surface, filename.c_str());
 }
 
 void DrawingWindow::savePPM(const std::string &filename) const {
-	std::ofstream outputStream(filename, std::ofstream::out);
-	outputStream << "P6\n";
-	outputStream << width << " " << height << "\n";
-	outputStream << "255\n";
-
-	for (size_t i = 0; i < width * height; i++) {
-		std::array<char, 3> rgb {{
-				static_cast<char> ((pixelBuffer[i] >> 16) & 0xFF),
-				static_cast<char> ((pixelBuffer[i] >> 8) & 0xFF),
-				static_cast<char> ((pixelBuffer[i] >> 0) & 0xFF)
-		}};
-		outputStream.write(rgb.data(), 3);
+	std::lock_guard<std::mutex> lock(frontBufferMutex);
+	writePPM(filename, frontBuffer.data, width, height, pixelBuffer.stride);
+}
+
+// Only records the request, as a render thread may still be drawing and pushing wake up events
+void DrawingWindow::checkForQuit(const SDL_Event &event) {
+	if ((event.type == SDL_QUIT) || ((event.type == SDL_KEYDOWN) && (event.key.keysym.sym == SDLK_ESCAPE))) {
+		quitRequested = true;
 	}
-	outputStream.close();
 }
 
+bool DrawingWindow::shouldQuit() const {
+	return quitRequested;
+}
+
+// Tears SDL down - nothing else may use the window afterwards
+void DrawingWindow::close() {
+	SDL_DestroyTexture(texture);
+	SDL_DestroyRenderer(renderer);
+	SDL_DestroyWindow(window);
+	SDL_Quit();
+}
+
+// Returns one event per call - keep calling until it returns false to drain the queue without losing input
+// Once a quit is requested it returns false without passing on any more events
 bool DrawingWindow::pollForInputEvents(SDL_Event &event) {
-	if (SDL_PollEvent(&event)) {
-		if ((event.type == SDL_QUIT) || ((event.type == SDL_KEYDOWN) && (event.key.keysym.sym == SDLK_ESCAPE))) {
-			SDL_DestroyTexture(texture);
-			SDL_DestroyRenderer(renderer);
-			SDL_DestroyWindow(window);
-			SDL_Quit();
-			printMessageAndQuit("Exiting", nullptr);
-		}
-		SDL_Event dummy;
-		// Clear the event queue by getting all available events
-		// This seems like bad practice (because it will skip some events) however preventing backlog is paramount !
-		while (SDL_PollEvent(&dummy));
-		return true;
+	while (!quitRequested && SDL_PollEvent(&event)) {
+		checkForQuit(event);
+		if (quitRequested) return false;
+		if (event.type == SDL_WINDOWEVENT) presentRequested = true;
+		else if (event.type != frameReadyEvent) return true;
 	}
 	return false;
 }
 
+// Blocks until an event arrives, returns false if it was only a frame-ready wake up or window event
+bool DrawingWindow::waitForInputEvents(SDL_Event &event) {
+	if (!SDL_WaitEvent(&event)) return false;
+	checkForQuit(event);
+	if (quitRequested) return false;
+	// The window may have been uncovered or resized, so the next renderFrame must present even if nothing changed
+	if (event.type == SDL_WINDOWEVENT) {
+		presentRequested = true;
+		return false;
+	}
+	return event.type != frameReadyEvent;
+}
+
+// The back buffer that a render thread draws into before calling swapBuffers
+FrameBuffer &DrawingWindow::getBackBuffer() {
+	return pixelBuffer;
+}
+
 void DrawingWindow::setPixelColour(size_t x, size_t y, uint32_t colour) {
-	if ((x >= width) || (y >= height)) {
-		std::cout << x << "," << y << " not on visible screen area" << std::endl;
-	} else pixelBuffer[(y * width) + x] = colour;
+	pixelBuffer.setPixelColour(x, y, colour);
 }
 
 uint32_t DrawingWindow::getPixelColour(size_t x, size_t y) {
-	if ((x >= width) || (y >= height)) {
-		std::cout << x << "," << y << " not on visible screen area" << std::endl;
-		return -1;
-	} else return pixelBuffer[(y * width) + x];
+	return pixelBuffer.getPixelColour(x, y);
 }
 
 void DrawingWindow::clearPixels() {
-	std::fill(pixelBuffer.begin(), pixelBuffer.end(), 0);
+	pixelBuffer.clearPixels();
 }
 
 void printMessageAndQuit(const std::string &message, const char *error) {
@@ -3,7 +3,9 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <mutex>
 #include "SDL.h"
+#include "FrameBuffer.h"
 
 class DrawingWindow {
 
@@ -15,7 +17,21 @@ private:
 	SDL_Window *window;
 	SDL_Renderer *renderer;
 	SDL_Texture *texture;
-	std::vector<uint32_t> pixelBuffer;
+	// Back buffer is drawn into by the render thread, front buffer holds the last completed frame
+	FrameBuffer pixelBuffer;
+	AlignedBuffer<uint32_t> frontBuffer;
+	mutable std::mutex frontBufferMutex;
+	bool frameReady;
+	uint32_t frameReadyEvent;
+
+	// One flag per DIRTY_TILE_SIZE square that changed but hasn't been uploaded to the texture yet
+	std::vector<uint8_t> pendingTiles;
+	bool presentRequested;
+	bool quitRequested;
+
+	void checkForQuit(const SDL_Event &event);
+	bool copyTileIfChanged(size_t tileX, size_t tileY);
+	void uploadTiles(size_t tileY, size_t fromTileX, size_t toTileX);
 
 public:
 	DrawingWindow();
@@ -24,6 +40,12 @@ public:
 	void savePPM(const std::string &filename) const;
 	void saveBMP(const std::string &filename) const;
 	bool pollForInputEvents(SDL_Event &event);
+	bool waitForInputEvents(SDL_Event &event);
+	// Set once ESC is pressed or the window is closed - stop anything still drawing into it, then call close
+	bool shouldQuit() const;
+	void close();
+	void swapBuffers();
+	FrameBuffer &getBackBuffer();
 	void setPixelColour(size_t x, size_t y, uint32_t colour);
 	uint32_t getPixelColour(size_t x, size_t y);
 	void clearPixels();
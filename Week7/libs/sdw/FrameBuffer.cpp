@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "FrameBuffer.h"
+
+size_t alignedStride(size_t width) {
+	size_t pixelsPerLine = CACHE_LINE_SIZE / sizeof(uint32_t);
+	return ((width + pixelsPerLine - 1) / pixelsPerLine) * pixelsPerLine;
+}
+
+FrameBuffer::FrameBuffer() : width(0), height(0), stride(0), tilesX(0), tilesY(0) {}
+
+FrameBuffer::FrameBuffer(size_t w, size_t h) :
+		width(w),
+		height(h),
+		stride(alignedStride(w)),
+		tilesX((w + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE),
+		tilesY((h + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE),
+		dirtyTiles(tilesX * tilesY, 1),
+		pixels(stride * h),
+		depth(stride * h) {
+	std::fill(pixels.data, pixels.data + pixels.size, 0);
+	std::fill(depth.data, depth.data + depth.size, 0.0f);
+}
+
+// Direct access to a whole row of colours, the row is assumed to be written
+uint32_t *FrameBuffer::getRow(size_t y) {
+	markDirty(0, y, width - 1, y);
+	return &pixels[y * stride];
+}
+
+const uint32_t *FrameBuffer::getRow(size_t y) const {
+	return &pixels[y * stride];
+}
+
+float *FrameBuffer::getDepthRow(size_t y) {
+	return &depth[y * stride];
+}
+
+const float *FrameBuffer::getDepthRow(size_t y) const {
+	return &depth[y * stride];
+}
+
+void FrameBuffer::setPixelColour(size_t x, size_t y, uint32_t colour) {
+	if ((x >= width) || (y >= height)) {
+#ifndef NDEBUG
+		std::cout << x << "," << y << " not on visible screen area" << std::endl;
+#endif
+	} else {
+		pixels[(y * stride) + x] = colour;
+		dirtyTiles[(y / DIRTY_TILE_SIZE) * tilesX + (x / DIRTY_TILE_SIZE)] = 1;
+	}
+}
+
+uint32_t FrameBuffer::getPixelColour(size_t x, size_t y) const {
+	if ((x >= width) || (y >= height)) {
+#ifndef NDEBUG
+		std::cout << x << "," << y << " not on visible screen area" << std::endl;
+#endif
+		return -1;
+	} else return pixels[(y * stride) + x];
+}
+
+// Clips the half-open span [fromX, toX) on row y to the buffer, returns false if nothing is left
+static bool clipSpan(int y, int &fromX, int &toX, size_t width, size_t height) {
+	if (y < 0 || size_t(y) >= height) {
+#ifndef NDEBUG
+		std::cout << "row " << y << " not on visible screen area" << std::endl;
+#endif
+		return false;
+	}
+	fromX = std::max(fromX, 0);
+	toX = std::min(toX, int(width));
+	return fromX < toX;
+}
+
+// Copies colours into the half-open span [fromX, toX) of row y - colours[0] belongs at fromX
+// Bounds are checked once for the whole span and anything off screen is clipped
+void FrameBuffer::writeSpan(int y, int fromX, int toX, const uint32_t *colours) {
+	int clippedFromX = fromX;
+	if (!clipSpan(y, clippedFromX, toX, width, height)) return;
+	std::memcpy(&pixels[y * stride + clippedFromX], colours + (clippedFromX - fromX), (toX - clippedFromX) * sizeof(uint32_t));
+	markDirty(clippedFromX, y, toX - 1, y);
+}
+
+void FrameBuffer::fillSpan(int y, int fromX, int toX, uint32_t colour) {
+	if (!clipSpan(y, fromX, toX, width, height)) return;
+	std::fill(&pixels[y * stride + fromX], &pixels[y * stride + toX], colour);
+	markDirty(fromX, y, toX - 1, y);
+}
+
+void FrameBuffer::clearPixels() {
+	std::fill(pixels.data, pixels.data + pixels.size, 0);
+	std::fill(dirtyTiles.begin(), dirtyTiles.end(), 1);
+}
+
+void FrameBuffer::clearDepth(float value) {
+	std::fill(depth.data, depth.data + depth.size, value);
+}
+
+// Flags the tiles covering the inclusive pixel rectangle as written
+void FrameBuffer::markDirty(size_t fromX, size_t fromY, size_t toX, size_t toY) {
+	toX = std::min(toX, width - 1);
+	toY = std::min(toY, height - 1);
+	for (size_t tileY = fromY / DIRTY_TILE_SIZE; tileY <= toY / DIRTY_TILE_SIZE; tileY++) {
+		for (size_t tileX = fromX / DIRTY_TILE_SIZE; tileX <= toX / DIRTY_TILE_SIZE; tileX++) {
+			dirtyTiles[tileY * tilesX + tileX] = 1;
+		}
+	}
+}
+
+void FrameBuffer::savePPM(const std::string &filename) const {
+	writePPM(filename, pixels.data, width, height, stride);
+}
+
+void writePPM(const std::string &filename, const uint32_t *pixels, size_t width, size_t height, size_t stride) {
+	std::ofstream outputStream(filename, std::ofstream::out);
+	outputStream << "P6\n";
+	outputStream << width << " " << height << "\n";
+	outputStream << "255\n";
+
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			uint32_t pixel = pixels[y * stride + x];
+			std::array<char, 3> rgb {{
+					static_cast<char> ((pixel >> 16) & 0xFF),
+					static_cast<char> ((pixel >> 8) & 0xFF),
+					static_cast<char> ((pixel >> 0) & 0xFF)
+			}};
+			outputStream.write(rgb.data(), 3);
+		}
+	}
+	outputStream.close();
+}
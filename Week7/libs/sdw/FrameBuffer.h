@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define CACHE_LINE_SIZE 64
+
+// Side length in pixels of the square regions that dirty tracking and texture uploads work in
+#define DIRTY_TILE_SIZE 32
+
+// Heap array whose first element starts on a cache line boundary
+template <typename T>
+class AlignedBuffer {
+public:
+	AlignedBuffer() : data(nullptr), size(0) {}
+
+	explicit AlignedBuffer(size_t count) : size(count), storage(new char[count * sizeof(T) + CACHE_LINE_SIZE]) {
+		void *unaligned = storage.get();
+		size_t space = count * sizeof(T) + CACHE_LINE_SIZE;
+		data = static_cast<T *>(std::align(CACHE_LINE_SIZE, count * sizeof(T), unaligned, space));
+	}
+
+	T *data;
+	size_t size;
+
+	T &operator[](size_t i) { return data[i]; }
+	const T &operator[](size_t i) const { return data[i]; }
+
+private:
+	std::unique_ptr<char[]> storage;
+};
+
+// A render target: ARGB colour and depth planes, both row-major with the same row stride
+// Every row starts on a cache line, so stride may be a little wider than width
+class FrameBuffer {
+public:
+	size_t width;
+	size_t height;
+	size_t stride;
+
+	FrameBuffer();
+	FrameBuffer(size_t w, size_t h);
+
+	uint32_t *getRow(size_t y);
+	const uint32_t *getRow(size_t y) const;
+	float *getDepthRow(size_t y);
+	const float *getDepthRow(size_t y) const;
+
+	void setPixelColour(size_t x, size_t y, uint32_t colour);
+	uint32_t getPixelColour(size_t x, size_t y) const;
+	void writeSpan(int y, int fromX, int toX, const uint32_t *colours);
+	void fillSpan(int y, int fromX, int toX, uint32_t colour);
+	void clearPixels();
+	void clearDepth(float depth);
+
+	// Dirty tiles record which DIRTY_TILE_SIZE squares were written since they were last cleared
+	void markDirty(size_t fromX, size_t fromY, size_t toX, size_t toY);
+	size_t tilesX;
+	size_t tilesY;
+	std::vector<uint8_t> dirtyTiles;
+
+	void savePPM(const std::string &filename) const;
+
+private:
+	AlignedBuffer<uint32_t> pixels;
+	AlignedBuffer<float> depth;
+};
+
+size_t alignedStride(size_t width);
+void writePPM(const std::string &filename, const uint32_t *pixels, size_t width, size_t height, size_t stride);
@@ -0,0 +1,33 @@
+#include <algorithm>
+#include "GBuffer.h"
+
+void GBuffer::begin(size_t width, size_t height, ShadingModel model) {
+	if (target.width != width || target.height != height) {
+		target = FrameBuffer(width, height);
+		normals.resize(width * height);
+		materialIds.resize(width * height);
+		brightnesses.resize(width * height);
+	}
+	shadingModel = model;
+	target.clearPixels();
+	target.clearDepth(0.0);
+	std::fill(materialIds.begin(), materialIds.end(), -1);
+}
+
+void GBuffer::setTriangle(int32_t materialId, glm::vec3 normal) {
+	currentMaterialId = materialId;
+	currentNormal = normal;
+}
+
+void GBuffer::write(size_t x, size_t y) {
+	size_t index = y * target.width + x;
+	materialIds[index] = currentMaterialId;
+	normals[index] = currentNormal;
+}
+
+void GBuffer::write(size_t x, size_t y, glm::vec3 normal, float brightness) {
+	size_t index = y * target.width + x;
+	materialIds[index] = currentMaterialId;
+	normals[index] = normal;
+	brightnesses[index] = brightness;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "FrameBuffer.h"
+
+// FLAT_SHADING - lit with each triangle's own normal
+// GOURAUD_SHADING - lit at each vertex, with the light interpolated across the triangle
+// PHONG_SHADING - vertex normals interpolated across the triangle, then lit at every point
+enum ShadingModel { FLAT_SHADING, GOURAUD_SHADING, PHONG_SHADING };
+
+// What the rasteriser found at each pixel, for lighting to be worked out afterwards in one pass over the image
+// Albedo and depth go in the usual colour and depth planes so the depth test works just as it does for forward shading
+class GBuffer {
+public:
+	// Albedo in the colour plane, 1 / z in the depth plane (0 where nothing was drawn)
+	FrameBuffer target;
+	// Surface normal, not necessarily facing the camera
+	std::vector<glm::vec3> normals;
+	// Index into the materials (one per triangle) of what each pixel sees, -1 where nothing was drawn
+	std::vector<int32_t> materialIds;
+	// Light interpolated from the triangle's vertices, only written with Gouraud shading
+	std::vector<float> brightnesses;
+	// Light at each corner of each triangle, to be filled in before drawing with Gouraud shading
+	std::vector<std::array<float, 3>> vertexBrightnesses;
+	// With anything but flat shading the rasteriser interpolates a normal and brightness for every pixel
+	ShadingModel shadingModel = FLAT_SHADING;
+
+	// Clears every plane, reallocating them if the size has changed
+	void begin(size_t width, size_t height, ShadingModel model);
+
+	// Called before each triangle is drawn, everything it covers is written with these
+	void setTriangle(int32_t materialId, glm::vec3 normal);
+
+	void write(size_t x, size_t y);
+	// For smooth shading, normal needn't be normalised
+	void write(size_t x, size_t y, glm::vec3 normal, float brightness);
+
+private:
+	int32_t currentMaterialId = -1;
+	glm::vec3 currentNormal;
+};
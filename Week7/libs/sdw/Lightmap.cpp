@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include "Lightmap.h"
+
+#define LIGHTMAP_FILE_VERSION 1
+
+Lightmap::Lightmap() : width(0), height(0) {}
+
+// Size of a triangle's cell and where its vertices sit inside it, relative to the cell's corner
+struct LightmapCell {
+	int width;
+	int height;
+	std::array<glm::vec2, 3> points;
+};
+
+// Unfolds the triangle into the plane with its first edge along x, so texels keep the same size everywhere on it
+static LightmapCell layoutCell(const ModelTriangle &triangle, float texelsPerUnit, int maxCellSize) {
+	glm::vec3 edge1 = triangle.vertices[1] - triangle.vertices[0];
+	glm::vec3 edge2 = triangle.vertices[2] - triangle.vertices[0];
+	float edge1Length = glm::length(edge1);
+	glm::vec3 xAxis = (edge1Length > 0.0f) ? edge1 / edge1Length : glm::vec3(1.0, 0.0, 0.0);
+
+	std::array<glm::vec2, 3> points = {{
+		glm::vec2(0.0, 0.0),
+		glm::vec2(edge1Length, 0.0),
+		glm::vec2(glm::dot(edge2, xAxis), glm::length(glm::cross(xAxis, edge2)))
+	}};
+	float minX = std::min(0.0f, points[2].x);
+	float extentX = std::max(edge1Length, points[2].x) - minX;
+	float extentY = points[2].y;
+
+	// Large triangles get fewer texels per unit rather than an oversized cell
+	int maxTexels = maxCellSize - 2 * LIGHTMAP_GUTTER;
+	float scale = texelsPerUnit;
+	if (std::max(extentX, extentY) * scale > maxTexels) scale = maxTexels / std::max(extentX, extentY);
+
+	LightmapCell cell;
+	cell.width = std::max(int(ceil(extentX * scale)), 1) + 2 * LIGHTMAP_GUTTER;
+	cell.height = std::max(int(ceil(extentY * scale)), 1) + 2 * LIGHTMAP_GUTTER;
+	for (int i = 0; i < 3; i++) {
+		cell.points[i] = (points[i] - glm::vec2(minX, 0.0)) * scale + glm::vec2(LIGHTMAP_GUTTER);
+	}
+	return cell;
+}
+
+// Barycentric (u, v) of point in the 2D triangle, pulled back onto the triangle if it lies outside
+static glm::vec2 getClampedBarycentric(const std::array<glm::vec2, 3> &points, glm::vec2 point) {
+	glm::vec2 edge1 = points[1] - points[0];
+	glm::vec2 edge2 = points[2] - points[0];
+	glm::vec2 offset = point - points[0];
+	float determinant = edge1.x * edge2.y - edge1.y * edge2.x;
+	if (std::abs(determinant) < 1e-12f) return glm::vec2(1.0f / 3.0f);
+	float u = (offset.x * edge2.y - offset.y * edge2.x) / determinant;
+	float v = (edge1.x * offset.y - edge1.y * offset.x) / determinant;
+	float w = 1.0f - u - v;
+	u = std::max(u, 0.0f);
+	v = std::max(v, 0.0f);
+	w = std::max(w, 0.0f);
+	return glm::vec2(u, v) / (u + v + w);
+}
+
+// Cells are packed onto shelves, tallest first, in an atlas roughly as wide as it is tall
+Lightmap::Lightmap(const std::vector<ModelTriangle> &triangles, float texelsPerUnit, int maxCellSize) {
+	std::vector<LightmapCell> cells;
+	std::vector<size_t> order;
+	size_t totalArea = 0;
+	int widestCell = 0;
+	for (size_t i = 0; i < triangles.size(); i++) {
+		cells.push_back(layoutCell(triangles[i], texelsPerUnit, maxCellSize));
+		order.push_back(i);
+		totalArea += cells[i].width * cells[i].height;
+		widestCell = std::max(widestCell, cells[i].width);
+	}
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return cells[a].height > cells[b].height; });
+
+	width = std::max(size_t(ceil(sqrt(float(totalArea)) * 1.1f)), size_t(widestCell));
+	std::vector<glm::ivec2> corners(cells.size());
+	size_t shelfX = 0;
+	size_t shelfY = 0;
+	size_t shelfHeight = 0;
+	for (size_t i = 0; i < order.size(); i++) {
+		const LightmapCell &cell = cells[order[i]];
+		if (shelfX + cell.width > width) {
+			shelfY += shelfHeight;
+			shelfX = 0;
+			shelfHeight = 0;
+		}
+		corners[order[i]] = glm::ivec2(shelfX, shelfY);
+		shelfX += cell.width;
+		shelfHeight = std::max(shelfHeight, size_t(cell.height));
+	}
+	height = shelfY + shelfHeight;
+
+	texels.assign(width * height, glm::vec3(0.0));
+	texelTriangles.assign(width * height, -1);
+	texelBarycentrics.assign(width * height, glm::vec2(0.0));
+	coordinates.resize(triangles.size());
+	for (size_t i = 0; i < cells.size(); i++) {
+		const LightmapCell &cell = cells[i];
+		for (int j = 0; j < 3; j++) {
+			coordinates[i][j] = TexturePoint(corners[i].x + cell.points[j].x, corners[i].y + cell.points[j].y);
+		}
+		for (int y = 0; y < cell.height; y++) {
+			for (int x = 0; x < cell.width; x++) {
+				size_t index = (corners[i].y + y) * width + corners[i].x + x;
+				texelTriangles[index] = int32_t(i);
+				texelBarycentrics[index] = getClampedBarycentric(cell.points, glm::vec2(x + 0.5f, y + 0.5f));
+			}
+		}
+	}
+}
+
+glm::vec3 Lightmap::getTexelPoint(const std::vector<ModelTriangle> &triangles, size_t x, size_t y) const {
+	const ModelTriangle &triangle = triangles[texelTriangles[y * width + x]];
+	glm::vec2 barycentric = texelBarycentrics[y * width + x];
+	return triangle.vertices[0]
+		+ barycentric.x * (triangle.vertices[1] - triangle.vertices[0])
+		+ barycentric.y * (triangle.vertices[2] - triangle.vertices[0]);
+}
+
+glm::vec3 Lightmap::sample(float x, float y) const {
+	// Texel centres sit at half coordinates
+	float fx = std::min(std::max(x - 0.5f, 0.0f), float(width - 1));
+	float fy = std::min(std::max(y - 0.5f, 0.0f), float(height - 1));
+	size_t x0 = size_t(fx);
+	size_t y0 = size_t(fy);
+	size_t x1 = std::min(x0 + 1, width - 1);
+	size_t y1 = std::min(y0 + 1, height - 1);
+	float tx = fx - x0;
+	float ty = fy - y0;
+	glm::vec3 top = glm::mix(texels[y0 * width + x0], texels[y0 * width + x1], tx);
+	glm::vec3 bottom = glm::mix(texels[y1 * width + x0], texels[y1 * width + x1], tx);
+	return glm::mix(top, bottom, ty);
+}
+
+bool Lightmap::save(const std::string &filename, uint64_t key) const {
+	std::ofstream outputStream(filename, std::ofstream::out | std::ofstream::binary);
+	if (!outputStream) return false;
+	uint32_t version = LIGHTMAP_FILE_VERSION;
+	uint64_t header[3] = {uint64_t(width), uint64_t(height), uint64_t(coordinates.size())};
+	outputStream.write("LMAP", 4);
+	outputStream.write(reinterpret_cast<const char *>(&version), sizeof(version));
+	outputStream.write(reinterpret_cast<const char *>(&key), sizeof(key));
+	outputStream.write(reinterpret_cast<const char *>(header), sizeof(header));
+	for (size_t i = 0; i < coordinates.size(); i++) {
+		for (int j = 0; j < 3; j++) {
+			float point[2] = {coordinates[i][j].x, coordinates[i][j].y};
+			outputStream.write(reinterpret_cast<const char *>(point), sizeof(point));
+		}
+	}
+	outputStream.write(reinterpret_cast<const char *>(texels.data()), texels.size() * sizeof(glm::vec3));
+	return bool(outputStream);
+}
+
+// Leaves the lightmap untouched and returns false if the file is missing, damaged or was baked for something else
+bool Lightmap::load(const std::string &filename, uint64_t key, size_t triangleCount) {
+	std::ifstream inputStream(filename, std::ifstream::in | std::ifstream::binary);
+	char magic[4];
+	uint32_t version = 0;
+	uint64_t fileKey = 0;
+	uint64_t header[3] = {0, 0, 0};
+	inputStream.read(magic, 4);
+	inputStream.read(reinterpret_cast<char *>(&version), sizeof(version));
+	inputStream.read(reinterpret_cast<char *>(&fileKey), sizeof(fileKey));
+	inputStream.read(reinterpret_cast<char *>(header), sizeof(header));
+	if (!inputStream || std::memcmp(magic, "LMAP", 4) != 0 || version != LIGHTMAP_FILE_VERSION) return false;
+	if (fileKey != key || header[2] != triangleCount) return false;
+
+	std::vector<std::array<TexturePoint, 3>> fileCoordinates(triangleCount);
+	for (size_t i = 0; i < triangleCount; i++) {
+		for (int j = 0; j < 3; j++) {
+			float point[2];
+			inputStream.read(reinterpret_cast<char *>(point), sizeof(point));
+			fileCoordinates[i][j] = TexturePoint(point[0], point[1]);
+		}
+	}
+	std::vector<glm::vec3> fileTexels(header[0] * header[1]);
+	inputStream.read(reinterpret_cast<char *>(fileTexels.data()), fileTexels.size() * sizeof(glm::vec3));
+	if (!inputStream) return false;
+
+	width = header[0];
+	height = header[1];
+	coordinates.swap(fileCoordinates);
+	texels.swap(fileTexels);
+	texelTriangles.clear();
+	texelBarycentrics.clear();
+	return true;
+}
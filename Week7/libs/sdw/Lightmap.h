@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ModelTriangle.h"
+#include "TexturePoint.h"
+
+// Texels of padding around each triangle's cell so bilinear lookups never reach a neighbouring cell
+#define LIGHTMAP_GUTTER 1
+
+// An atlas holding the light reaching every point of a static set of triangles
+// Each triangle is unfolded flat into its own cell, keeping its shape, at a fixed number of texels per unit
+class Lightmap {
+public:
+	size_t width;
+	size_t height;
+	// Where each triangle's vertices land in the atlas, in texels
+	std::vector<std::array<TexturePoint, 3>> coordinates;
+	// Light reaching each texel per colour channel, 1.0 being fully lit
+	std::vector<glm::vec3> texels;
+	// Which triangle each texel covers (-1 if none) and where on it as barycentric (u, v)
+	// Gutter texels are clamped onto the triangle's edge so filtering never sees unbaked values
+	// Only needed for baking, so not saved
+	std::vector<int32_t> texelTriangles;
+	std::vector<glm::vec2> texelBarycentrics;
+
+	Lightmap();
+	Lightmap(const std::vector<ModelTriangle> &triangles, float texelsPerUnit, int maxCellSize);
+
+	glm::vec3 getTexelPoint(const std::vector<ModelTriangle> &triangles, size_t x, size_t y) const;
+	// Bilinearly filtered light at atlas position (x, y) in texels
+	glm::vec3 sample(float x, float y) const;
+
+	// key identifies what was baked, so a file baked from a different scene or light is not loaded
+	bool save(const std::string &filename, uint64_t key) const;
+	bool load(const std::string &filename, uint64_t key, size_t triangleCount);
+};
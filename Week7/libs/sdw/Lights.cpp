@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <limits>
+#include "Lights.h"
+#include "Sampler.h"
+
+int AreaLight::getSampleCount() const {
+	return (shape == POINT_LIGHT) ? 1 : samples;
+}
+
+float AreaLight::getExtent() const {
+	if (shape == QUAD_LIGHT) return 0.5f * std::max(glm::length(edgeU + edgeV), glm::length(edgeU - edgeV));
+	if (shape == SPHERE_LIGHT) return radius;
+	return 0.0;
+}
+
+float AreaLight::getReach() const {
+	return influenceRadius + getExtent();
+}
+
+float AreaLight::getInfluence(float distance) const {
+	float ratio = distance / influenceRadius;
+	float window = std::max(1.0f - ratio * ratio * ratio * ratio, 0.0f);
+	return intensity * window * window;
+}
+
+bool AreaLight::intersect(glm::vec3 origin, glm::vec3 direction, float maxDistance, float &distance, float &cosine) const {
+	if (shape == QUAD_LIGHT) {
+		glm::vec3 normal = glm::normalize(glm::cross(edgeU, edgeV));
+		float denominator = glm::dot(direction, normal);
+		if (std::abs(denominator) < 1e-6f) return false;
+		float t = glm::dot(position - origin, normal) / denominator;
+		if (t <= 0.0f || t >= maxDistance) return false;
+		// Solves offset = a * edgeU + b * edgeV, which allows for edges that aren't perpendicular
+		glm::vec3 offset = origin + t * direction - position;
+		float uu = glm::dot(edgeU, edgeU);
+		float uv = glm::dot(edgeU, edgeV);
+		float vv = glm::dot(edgeV, edgeV);
+		float determinant = uu * vv - uv * uv;
+		float a = (glm::dot(offset, edgeU) * vv - glm::dot(offset, edgeV) * uv) / determinant;
+		float b = (glm::dot(offset, edgeV) * uu - glm::dot(offset, edgeU) * uv) / determinant;
+		if (std::abs(a) > 0.5f || std::abs(b) > 0.5f) return false;
+		distance = t;
+		cosine = denominator;
+		return true;
+	}
+	if (shape == SPHERE_LIGHT) {
+		glm::vec3 offset = origin - position;
+		float b = glm::dot(offset, direction);
+		float c = glm::dot(offset, offset) - radius * radius;
+		float discriminant = b * b - c;
+		if (discriminant < 0.0f) return false;
+		float root = std::sqrt(discriminant);
+		float t = (-b - root > 0.0f) ? -b - root : -b + root;
+		if (t <= 0.0f || t >= maxDistance) return false;
+		distance = t;
+		cosine = glm::dot(direction, glm::normalize(origin + t * direction - position));
+		return true;
+	}
+	return false;
+}
+
+float AreaLight::getRadiance(float distance, float cosine) const {
+	float projectedArea = 0.0;
+	if (shape == QUAD_LIGHT) projectedArea = glm::length(glm::cross(edgeU, edgeV)) * std::max(std::abs(cosine), 1e-4f);
+	else if (shape == SPHERE_LIGHT) projectedArea = M_PI * radius * radius;
+	if (projectedArea <= 0.0f) return 0.0;
+	return M_PI * BRIGHTNESS_SCALING * getInfluence(distance) / projectedArea;
+}
+
+glm::vec3 AreaLight::samplePoint(glm::vec3 shadedPoint, float s, float t) const {
+	if (shape == QUAD_LIGHT) return position + (s - 0.5f) * edgeU + (t - 0.5f) * edgeV;
+	if (shape == SPHERE_LIGHT) {
+		glm::vec3 towardsPoint = glm::normalize(shadedPoint - position);
+		glm::vec3 tangent;
+		glm::vec3 bitangent;
+		getTangentBasis(towardsPoint, tangent, bitangent);
+		float r = radius * std::sqrt(s);
+		float theta = 2.0f * M_PI * t;
+		return position + radius * towardsPoint + r * std::cos(theta) * tangent + r * std::sin(theta) * bitangent;
+	}
+	return position;
+}
+
+float AreaLight::getSamplePdf(glm::vec3 shadedPoint, glm::vec3 lightPoint) const {
+	glm::vec3 direction = glm::normalize(lightPoint - shadedPoint);
+	if (shape == QUAD_LIGHT) {
+		glm::vec3 normal = glm::cross(edgeU, edgeV);
+		float area = glm::length(normal);
+		float cosine = std::max(std::abs(glm::dot(direction, normal / area)), 1e-4f);
+		glm::vec3 offset = lightPoint - shadedPoint;
+		return glm::dot(offset, offset) / (area * cosine);
+	}
+	if (shape == SPHERE_LIGHT) {
+		glm::vec3 towardsPoint = glm::normalize(shadedPoint - position);
+		float cosine = std::max(-glm::dot(direction, towardsPoint), 1e-4f);
+		float discDistance = glm::dot(shadedPoint - (position + radius * towardsPoint), towardsPoint) / cosine;
+		return discDistance * discDistance / (M_PI * radius * radius * cosine);
+	}
+	return 0.0;
+}
+
+LightGrid::LightGrid(glm::vec3 boundsMin, glm::vec3 boundsMax) : origin(boundsMin), resolution(LIGHT_GRID_RESOLUTION) {
+	cellSize = glm::max((boundsMax - boundsMin) / float(resolution), glm::vec3(1e-6f));
+	rebuild();
+}
+
+void LightGrid::rebuild() {
+	fillCells(false, cellStarts, cellLights);
+	fillCells(true, surfaceCellStarts, surfaceCellLights);
+	outsideLights.clear();
+	for (size_t i = 0; i < lights.size(); i++) {
+		if (lights[i].shape != POINT_LIGHT && isOutsideGrid(lights[i])) outsideLights.push_back(uint32_t(i));
+	}
+}
+
+void LightGrid::fit(glm::vec3 boundsMin, glm::vec3 boundsMax) {
+	glm::vec3 gridMax = origin + cellSize * float(resolution);
+	if (glm::all(glm::greaterThanEqual(boundsMin, origin)) && glm::all(glm::lessThanEqual(boundsMax, gridMax))) return;
+	// Only ever grows, so a repeating animation stops causing rebuilds once it has been all the way round
+	origin = glm::min(origin, boundsMin);
+	cellSize = glm::max((glm::max(gridMax, boundsMax) - origin) / float(resolution), glm::vec3(1e-6f));
+	rebuild();
+}
+
+const uint32_t *LightGrid::getLightsAt(glm::vec3 point, size_t &lightCount) const {
+	glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor((point - origin) / cellSize)), glm::ivec3(0), glm::ivec3(resolution - 1));
+	size_t index = (cell.z * resolution + cell.y) * resolution + cell.x;
+	lightCount = cellStarts[index + 1] - cellStarts[index];
+	return cellLights.data() + cellStarts[index];
+}
+
+const AreaLight *LightGrid::intersect(glm::vec3 rayOrigin, glm::vec3 direction, float maxDistance, float &distance, float &cosine) const {
+	const AreaLight *nearest = nullptr;
+	distance = maxDistance;
+	for (size_t i = 0; i < outsideLights.size(); i++) testLight(outsideLights[i], rayOrigin, direction, nearest, distance, cosine);
+	if (surfaceCellLights.empty()) return nearest;
+
+	// Clips the ray to the grid, axes the ray runs along are never crossed
+	float gridEnter = 0.0;
+	float gridExit = distance;
+	glm::vec3 gridMax = origin + cellSize * float(resolution);
+	glm::ivec3 step;
+	glm::vec3 nextCrossing;
+	glm::vec3 crossingSpacing;
+	for (int axis = 0; axis < 3; axis++) {
+		if (std::abs(direction[axis]) < 1e-12f) {
+			if (rayOrigin[axis] < origin[axis] || rayOrigin[axis] > gridMax[axis]) return nearest;
+			step[axis] = 0;
+			continue;
+		}
+		float inverse = 1.0f / direction[axis];
+		float slabNear = (origin[axis] - rayOrigin[axis]) * inverse;
+		float slabFar = (gridMax[axis] - rayOrigin[axis]) * inverse;
+		if (slabNear > slabFar) std::swap(slabNear, slabFar);
+		gridEnter = std::max(gridEnter, slabNear);
+		gridExit = std::min(gridExit, slabFar);
+		step[axis] = (direction[axis] > 0.0f) ? 1 : -1;
+	}
+	if (gridEnter > gridExit) return nearest;
+
+	glm::vec3 start = rayOrigin + gridEnter * direction;
+	glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor((start - origin) / cellSize)), glm::ivec3(0), glm::ivec3(resolution - 1));
+	for (int axis = 0; axis < 3; axis++) {
+		if (step[axis] == 0) {
+			nextCrossing[axis] = std::numeric_limits<float>::max();
+			crossingSpacing[axis] = 0.0;
+			continue;
+		}
+		float boundary = origin[axis] + (cell[axis] + (step[axis] > 0 ? 1 : 0)) * cellSize[axis];
+		nextCrossing[axis] = (boundary - rayOrigin[axis]) / direction[axis];
+		crossingSpacing[axis] = cellSize[axis] / std::abs(direction[axis]);
+	}
+
+	while (true) {
+		size_t index = (cell.z * resolution + cell.y) * resolution + cell.x;
+		for (uint32_t i = surfaceCellStarts[index]; i < surfaceCellStarts[index + 1]; i++) {
+			testLight(surfaceCellLights[i], rayOrigin, direction, nearest, distance, cosine);
+		}
+		int axis = (nextCrossing.x < nextCrossing.y) ? ((nextCrossing.x < nextCrossing.z) ? 0 : 2) : ((nextCrossing.y < nextCrossing.z) ? 1 : 2);
+		float cellExit = nextCrossing[axis];
+		if (cellExit >= std::min(distance, gridExit)) break;
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= resolution) break;
+		nextCrossing[axis] += crossingSpacing[axis];
+	}
+	return nearest;
+}
+
+bool LightGrid::isOutsideGrid(const AreaLight &light) const {
+	glm::vec3 gridMax = origin + cellSize * float(resolution);
+	float extent = light.getExtent();
+	return glm::any(glm::lessThan(light.position - extent, origin)) || glm::any(glm::greaterThan(light.position + extent, gridMax));
+}
+
+void LightGrid::testLight(uint32_t index, glm::vec3 rayOrigin, glm::vec3 direction, const AreaLight *&nearest, float &distance, float &cosine) const {
+	float lightDistance;
+	float lightCosine;
+	if (lights[index].intersect(rayOrigin, direction, distance, lightDistance, lightCosine)) {
+		nearest = &lights[index];
+		distance = lightDistance;
+		cosine = lightCosine;
+	}
+}
+
+template <typename Visitor>
+void LightGrid::forEachCell(bool surfaces, Visitor visit) const {
+	for (size_t i = 0; i < lights.size(); i++) {
+		if (surfaces && (lights[i].shape == POINT_LIGHT || isOutsideGrid(lights[i]))) continue;
+		float reach = surfaces ? lights[i].getExtent() : lights[i].getReach();
+		glm::vec3 centre = lights[i].position;
+		glm::ivec3 first = glm::clamp(glm::ivec3(glm::floor((centre - reach - origin) / cellSize)), glm::ivec3(0), glm::ivec3(resolution - 1));
+		glm::ivec3 last = glm::clamp(glm::ivec3(glm::floor((centre + reach - origin) / cellSize)), glm::ivec3(0), glm::ivec3(resolution - 1));
+		for (int z = first.z; z <= last.z; z++) {
+			for (int y = first.y; y <= last.y; y++) {
+				for (int x = first.x; x <= last.x; x++) {
+					glm::vec3 cellMin = origin + glm::vec3(x, y, z) * cellSize;
+					glm::vec3 closest = glm::clamp(centre, cellMin, cellMin + cellSize);
+					if (surfaces || glm::length(closest - centre) <= reach) visit((z * resolution + y) * resolution + x, uint32_t(i));
+				}
+			}
+		}
+	}
+}
+
+void LightGrid::fillCells(bool surfaces, std::vector<uint32_t> &starts, std::vector<uint32_t> &indices) const {
+	size_t cellCount = resolution * resolution * resolution;
+	starts.assign(cellCount + 1, 0);
+	forEachCell(surfaces, [&](size_t cell, uint32_t) { starts[cell + 1]++; });
+	for (size_t i = 0; i < cellCount; i++) starts[i + 1] += starts[i];
+	indices.resize(starts[cellCount]);
+	std::vector<uint32_t> filled(starts.begin(), starts.end() - 1);
+	forEachCell(surfaces, [&](size_t cell, uint32_t light) { indices[filled[cell]++] = light; });
+}
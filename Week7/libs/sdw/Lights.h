@@ -0,0 +1,101 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Diffuse surfaces send 1 / pi of the light reaching them back along each unit of solid angle
+#define BRIGHTNESS_SCALING float(1.0 / M_PI)
+// Light added everywhere so nothing is completely black
+#define MIN_BRIGHTNESS 0.2f
+// Share of its light a surface still gets where the light is blocked
+#define SHADOW_FADE 0.5f
+// Shadow rays start this far off the surface so they don't hit the triangle they left from
+#define SHADOW_BIAS 0.0001f
+// Cells along each side of a LightGrid
+#define LIGHT_GRID_RESOLUTION 16
+
+enum LightShape { POINT_LIGHT, QUAD_LIGHT, SPHERE_LIGHT };
+
+// A light with a size, sampled at several points per shaded pixel to give soft shadows
+// A quad spans position +/- edgeU / 2 +/- edgeV / 2, a sphere has the given radius around position
+// Light fades smoothly to nothing at influenceRadius from any point on the light, so lights far away can be skipped
+class AreaLight {
+public:
+	LightShape shape;
+	glm::vec3 position;
+	glm::vec3 edgeU;
+	glm::vec3 edgeV;
+	float radius;
+	int samples;
+	float intensity = 1.0;
+	float influenceRadius = 4.0;
+
+	int getSampleCount() const;
+	// Furthest any point on the light is from position
+	float getExtent() const;
+	// Nothing beyond this distance from position is lit
+	float getReach() const;
+	// Multiplies the inverse square falloff so it reaches zero at influenceRadius without a visible edge
+	float getInfluence(float distance) const;
+
+	// Finds where a ray first hits the light before maxDistance, and the cosine between the ray and the surface there
+	// Point lights have no surface, so are never hit
+	bool intersect(glm::vec3 origin, glm::vec3 direction, float maxDistance, float &distance, float &cosine) const;
+	// Radiance leaving the light towards a point distance away, seen at cosine to the light's surface
+	// Chosen to match the ray tracer, where every point sampled on the light shines equally in all directions
+	float getRadiance(float distance, float cosine) const;
+
+	// (s, t) in [0, 1)^2 maps uniformly over the quad, or over the disc of the sphere facing shadedPoint
+	glm::vec3 samplePoint(glm::vec3 shadedPoint, float s, float t) const;
+	// Probability density per unit solid angle, seen from shadedPoint, of samplePoint picking lightPoint
+	// Sphere lights are sampled over their facing disc, which covers the whole sphere as seen from shadedPoint
+	// Point lights are a single direction, so have no density
+	float getSamplePdf(glm::vec3 shadedPoint, glm::vec3 lightPoint) const;
+};
+
+// Buckets the lights into a uniform grid over the scene by how far each one reaches
+// Shading a point only considers the lights listed for its cell rather than every light in the scene
+// Each cell also lists the lights whose surface lies in it, so rays only test the lights in the cells they cross
+// Call rebuild() whenever lights are added, moved or resized
+class LightGrid {
+public:
+	std::vector<AreaLight> lights;
+
+	LightGrid(glm::vec3 boundsMin, glm::vec3 boundsMax);
+
+	void rebuild();
+	// Grows the grid to cover boundsMin to boundsMax, rebuilding it, if it doesn't already
+	// so points on triangles that have moved since it was made still find every light that reaches them
+	void fit(glm::vec3 boundsMin, glm::vec3 boundsMax);
+
+	// Indices into lights of every light that might reach point, lightCount of them
+	// Points outside the grid use the nearest cell
+	const uint32_t *getLightsAt(glm::vec3 point, size_t &lightCount) const;
+
+	// Finds the nearest light a ray hits before maxDistance, walking the cells it crosses front to back (Amanatides and Woo)
+	// and stopping at the first cell that ends beyond a hit already found
+	const AreaLight *intersect(glm::vec3 rayOrigin, glm::vec3 direction, float maxDistance, float &distance, float &cosine) const;
+
+private:
+	glm::vec3 origin;
+	glm::vec3 cellSize;
+	int resolution;
+	// Lights are stored per cell back to back, cellStarts[i] being where cell i's run begins
+	std::vector<uint32_t> cellStarts;
+	std::vector<uint32_t> cellLights;
+	std::vector<uint32_t> surfaceCellStarts;
+	std::vector<uint32_t> surfaceCellLights;
+	// Lights poking out of the grid could be hit by rays that never cross their cells, so every ray tests them
+	std::vector<uint32_t> outsideLights;
+
+	bool isOutsideGrid(const AreaLight &light) const;
+	void testLight(uint32_t index, glm::vec3 rayOrigin, glm::vec3 direction, const AreaLight *&nearest, float &distance, float &cosine) const;
+	void fillCells(bool surfaces, std::vector<uint32_t> &starts, std::vector<uint32_t> &indices) const;
+
+	// Calls visit(cell, light) for every cell whose box is within reach of each light,
+	// or with surfaces, for every cell the box around each light's surface overlaps
+	template <typename Visitor>
+	void forEachCell(bool surfaces, Visitor visit) const;
+};
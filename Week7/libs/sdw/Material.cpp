@@ -0,0 +1,29 @@
+#include "Material.h"
+
+void Material::setColour(Colour newColour) {
+	colour = newColour;
+	type = COLOUR;
+}
+
+void Material::setTextureMap(TextureMap newTextureMap) {
+	textureMap = newTextureMap;
+	type = TEXTURE;
+}
+
+float Material::getReflectivity() const {
+	if (illumination < 3 || illumination > 7) return 0.0;
+	return (specularColour.r + specularColour.g + specularColour.b) / 3.0f;
+}
+
+float Material::getTransparency() const {
+	if (illumination == 4 || illumination == 6 || illumination == 7) return 1.0f - dissolve;
+	return 0.0;
+}
+
+float Material::getDiffuseShare() const {
+	return (1.0f - getTransparency()) * (1.0f - getReflectivity());
+}
+
+bool Material::isSpecular() const {
+	return getDiffuseShare() < 1.0f;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "Colour.h"
+#include "TextureMap.h"
+
+enum MaterialType { TEXTURE, COLOUR };
+
+class Material {
+public:
+	MaterialType type;
+	Colour colour;
+	TextureMap textureMap;
+	// From the MTL file's Ks, Ns, Ni, d and illum, only ray traced frames use them
+	glm::vec3 specularColour = glm::vec3(0.0);
+	float specularExponent = 0.0;
+	float refractiveIndex = 1.0;
+	// 1 is opaque
+	float dissolve = 1.0;
+	// The MTL illumination model: 3 to 7 reflect as mirrors do, 4, 6 and 7 are see-through glass as well
+	int illumination = 2;
+
+	void setColour(Colour newColour);
+	void setTextureMap(TextureMap newTextureMap);
+
+	// Share of the light on the opaque part of the surface reflected as by a mirror, the mean of Ks
+	float getReflectivity() const;
+	// Share of the light let through the surface, split between reflection and refraction by the Fresnel equations
+	float getTransparency() const;
+	// Share left for the surface's own colour, lit as usual
+	float getDiffuseShare() const;
+	bool isSpecular() const;
+};
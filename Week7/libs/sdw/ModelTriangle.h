@@ -11,6 +11,8 @@ struct ModelTriangle {
 	std::array<TexturePoint, 3> texturePoints{};
 	Colour colour{};
 	glm::vec3 normal{};
+	// Normal of the surface at each vertex, for smooth shading
+	std::array<glm::vec3, 3> vertexNormals{};
 
 	ModelTriangle();
 	ModelTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, Colour trigColour);
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include "PathTracer.h"
+#include "RayTracing.h"
+#include "TileScheduler.h"
+
+// Lambertian diffuse plus a normalised Phong lobe, PATH_SPECULAR_WEIGHT of the energy going to the lobe
+// normal faces the side the path arrived from, outgoing points back along the path and incoming towards the next vertex
+static glm::vec3 evaluateBSDF(glm::vec3 albedo, glm::vec3 normal, glm::vec3 outgoing, glm::vec3 incoming) {
+	if (glm::dot(incoming, normal) <= 0.0f) return glm::vec3(0.0);
+	glm::vec3 reflection = 2.0f * glm::dot(normal, outgoing) * normal - outgoing;
+	float cosine = std::max(glm::dot(reflection, incoming), 0.0f);
+	float phong = (PATH_SPECULAR_EXPONENT + 2.0f) / (2.0f * M_PI) * std::pow(cosine, PATH_SPECULAR_EXPONENT);
+	return (1.0f - PATH_SPECULAR_WEIGHT) * albedo / float(M_PI) + glm::vec3(PATH_SPECULAR_WEIGHT * phong);
+}
+
+// Probability density of sampleBSDFDirection picking incoming, per unit solid angle
+static float getBSDFPdf(glm::vec3 normal, glm::vec3 outgoing, glm::vec3 incoming) {
+	float cosTheta = glm::dot(incoming, normal);
+	if (cosTheta <= 0.0f) return 0.0;
+	glm::vec3 reflection = 2.0f * glm::dot(normal, outgoing) * normal - outgoing;
+	float cosine = std::max(glm::dot(reflection, incoming), 0.0f);
+	float phongPdf = (PATH_SPECULAR_EXPONENT + 1.0f) / (2.0f * M_PI) * std::pow(cosine, PATH_SPECULAR_EXPONENT);
+	return (1.0f - PATH_SPECULAR_WEIGHT) * cosTheta / float(M_PI) + PATH_SPECULAR_WEIGHT * phongPdf;
+}
+
+// Picks the glossy lobe with probability PATH_SPECULAR_WEIGHT, otherwise the diffuse one, and samples a direction from it
+// Glossy directions can fall below the surface, getBSDFPdf gives those zero
+static glm::vec3 sampleBSDFDirection(glm::vec3 normal, glm::vec3 outgoing, Sampler &sampler) {
+	float choice = sampler.next1D();
+	glm::vec2 sample = sampler.next2D();
+	float s = sample.x;
+	float t = sample.y;
+	if (choice >= PATH_SPECULAR_WEIGHT) return sampleCosineHemisphere(normal, s, t);
+
+	glm::vec3 reflection = 2.0f * glm::dot(normal, outgoing) * normal - outgoing;
+	glm::vec3 tangent;
+	glm::vec3 bitangent;
+	getTangentBasis(reflection, tangent, bitangent);
+	float cosAlpha = std::pow(s, 1.0f / (PATH_SPECULAR_EXPONENT + 1.0f));
+	float sinAlpha = std::sqrt(std::max(1.0f - cosAlpha * cosAlpha, 0.0f));
+	float phi = 2.0f * M_PI * t;
+	return sinAlpha * std::cos(phi) * tangent + sinAlpha * std::sin(phi) * bitangent + cosAlpha * reflection;
+}
+
+// Power heuristic weight for a sample drawn with density pdf when the other strategy would have used otherPdf
+static float getMISWeight(float pdf, float otherPdf) {
+	return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+// Next event estimation: light arriving at point straight from one light picked at random from its grid cell
+// Weighted against the chance of the BSDF sample hitting the same point, which tracePath weights the other way
+static glm::vec3 sampleDirectLight(
+		const BVH &bvh,
+		const LightGrid &lightGrid,
+		glm::vec3 albedo,
+		glm::vec3 point,
+		glm::vec3 normal,
+		glm::vec3 outgoing,
+		Sampler &sampler) {
+	// Always takes the same dimensions, whether or not there are lights, so later bounces don't shift between them
+	float choice = sampler.next1D();
+	glm::vec2 sample = sampler.next2D();
+	size_t lightCount;
+	const uint32_t *lightIndices = lightGrid.getLightsAt(point, lightCount);
+	if (lightCount == 0) return glm::vec3(0.0);
+	const AreaLight &light = lightGrid.lights[lightIndices[std::min(size_t(choice * lightCount), lightCount - 1)]];
+	glm::vec3 lightPoint = light.samplePoint(point, sample.x, sample.y);
+	glm::vec3 incoming = lightPoint - point;
+	float distance = glm::length(incoming);
+	if (distance <= 0.0f) return glm::vec3(0.0);
+	incoming /= distance;
+	float cosine = glm::dot(incoming, normal);
+	if (cosine <= 0.0f) return glm::vec3(0.0);
+
+	// Incoming radiance over the probability of this sample, i.e. what one sample stands in for
+	float weightedRadiance;
+	if (light.shape == POINT_LIGHT) {
+		weightedRadiance = M_PI * BRIGHTNESS_SCALING * light.getInfluence(distance) / (distance * distance) * lightCount;
+	} else {
+		float lightPdf = light.getSamplePdf(point, lightPoint) / lightCount;
+		float lightCosine = (light.shape == QUAD_LIGHT) ? glm::dot(incoming, glm::normalize(glm::cross(light.edgeU, light.edgeV))) : 1.0f;
+		float bsdfPdf = getBSDFPdf(normal, outgoing, incoming);
+		weightedRadiance = light.getRadiance(distance, lightCosine) / lightPdf * getMISWeight(lightPdf, bsdfPdf);
+	}
+	if (weightedRadiance <= 0.0f) return glm::vec3(0.0);
+	if (bvh.occluded(point + normal * SHADOW_BIAS, incoming, distance - SHADOW_BIAS)) return glm::vec3(0.0);
+	return evaluateBSDF(albedo, normal, outgoing, incoming) * cosine * weightedRadiance;
+}
+
+// Radiance arriving at origin from along direction, following one random path through the scene
+static glm::vec3 tracePath(
+		const std::vector<ModelTriangle> &triangles,
+		const BVH &bvh,
+		const LightGrid &lightGrid,
+		glm::vec3 origin,
+		glm::vec3 direction,
+		Sampler &sampler) {
+	glm::vec3 radiance(0.0);
+	glm::vec3 throughput(1.0);
+	// How the last bounce was chosen, needed to weight a light it hits against next event estimation
+	float bsdfPdf = 0.0;
+	size_t lightCount = 0;
+	for (int depth = 0; depth < PATH_MAX_DEPTH; depth++) {
+		BVHHit hit;
+		bool hitSurface = bvh.intersect(origin, direction, hit);
+		float lightDistance;
+		float lightCosine;
+		const AreaLight *light = lightGrid.intersect(origin, direction, hitSurface ? hit.distance : std::numeric_limits<float>::infinity(), lightDistance, lightCosine);
+		if (light) {
+			float weight = 1.0;
+			// Lights missing from the last bounce's cell can't reach it, so give no light whichever way they're found
+			if (PATH_LIGHT_SAMPLING && depth > 0 && lightCount > 0) {
+				float lightPdf = light->getSamplePdf(origin, origin + lightDistance * direction) / lightCount;
+				weight = getMISWeight(bsdfPdf, lightPdf);
+			}
+			radiance += throughput * light->getRadiance(lightDistance, lightCosine) * weight;
+			break;
+		}
+		if (!hitSurface) break;
+
+		const Colour &colour = getHitColour(triangles, bvh, hit);
+		glm::vec3 albedo = glm::vec3(colour.red, colour.green, colour.blue) / 255.0f;
+		glm::vec3 point = origin + hit.distance * direction;
+		glm::vec3 normal = getHitNormal(triangles, hit);
+		if (glm::dot(normal, direction) > 0.0f) normal = -normal;
+		glm::vec3 outgoing = -direction;
+
+		if (PATH_LIGHT_SAMPLING) {
+			radiance += throughput * sampleDirectLight(bvh, lightGrid, albedo, point, normal, outgoing, sampler);
+			lightGrid.getLightsAt(point, lightCount);
+		}
+
+		glm::vec3 incoming = sampleBSDFDirection(normal, outgoing, sampler);
+		bsdfPdf = getBSDFPdf(normal, outgoing, incoming);
+		if (bsdfPdf <= 0.0f) break;
+		throughput *= evaluateBSDF(albedo, normal, outgoing, incoming) * glm::dot(incoming, normal) / bsdfPdf;
+
+		if (depth >= PATH_ROULETTE_DEPTH) {
+			float survival = std::min(std::max(throughput.r, std::max(throughput.g, throughput.b)), 0.95f);
+			if (sampler.next1D() >= survival) break;
+			throughput /= survival;
+		}
+		origin = point + normal * SHADOW_BIAS;
+		direction = incoming;
+	}
+	return radiance;
+}
+
+void PathTracer::reset() {
+	history.reset();
+	guidesFound = false;
+}
+
+bool PathTracer::converged() const {
+	return history.converged();
+}
+
+void PathTracer::render(
+		FrameBuffer &frameBuffer,
+		const std::vector<ModelTriangle> &triangles,
+		const BVH &bvh,
+		const CameraEnvironment &cameraEnv,
+		const LightGrid &lightGrid,
+		SamplerType samplerType,
+		bool reprojection,
+		Denoiser *denoiser) {
+	std::chrono::steady_clock::time_point passStart = std::chrono::steady_clock::now();
+	width = frameBuffer.width;
+	height = frameBuffer.height;
+	float RAY_SCALING = 1.0 / getPlaneScaling(frameBuffer);
+	bool moved = history.beginFrame(width, height, cameraEnv, RAY_SCALING, reprojection);
+	if (denoiser) denoiser->resize(width, height);
+	// The guides only change with the camera, unless something else has used the denoiser in between
+	bool findingGuides = denoiser && (moved || !guidesFound);
+	guidesFound = denoiser != nullptr;
+
+	getTileScheduler().forEachTile(width, height, RENDER_TILE_SIZE, [&](const Tile &tile) {
+		std::vector<uint32_t> row(tile.toX - tile.fromX);
+		for (int y = tile.fromY; y < tile.toY; y++) {
+			for (int x = tile.fromX; x < tile.toX; x++) {
+				if (moved || findingGuides) {
+					glm::vec3 point;
+					glm::vec3 normal;
+					glm::vec3 albedo;
+					bool found = findPrimaryHit(x, y, triangles, bvh, cameraEnv, lightGrid, RAY_SCALING, point, normal, albedo);
+					if (moved && found) history.reproject(x, y, point, normal);
+					else if (moved) history.clear(x, y);
+					if (findingGuides && found) denoiser->setGuides(x, y, normal, glm::length(point - cameraEnv.position), albedo);
+					else if (findingGuides) denoiser->clearGuides(x, y);
+				}
+				// Different every sample, so the jitter also antialiases edges as samples build up
+				Sampler sampler(samplerType, x, y);
+				sampler.startSample(history.frame);
+				glm::vec2 jitter = sampler.next2D();
+				float u = (float(x) + jitter.x - 0.5f - (width / 2)) * RAY_SCALING;
+				float v = -1 * (float(y) + jitter.y - 0.5f - (height / 2)) * RAY_SCALING;
+				glm::vec3 rayDirection = glm::normalize(cameraEnv.rotation * glm::vec3(u, v, -cameraEnv.focalLength));
+
+				glm::vec3 average = history.accumulate(x, y, tracePath(triangles, bvh, lightGrid, cameraEnv.position, rayDirection, sampler));
+				if (denoiser) {
+					size_t index = y * denoiser->stride + x;
+					// Clamped to what the display shows first, as for ray traced frames
+					for (int c = 0; c < 3; c++) denoiser->light[c][index] = std::min(average[c], 1.0f) / std::max(denoiser->albedo[c][index], DENOISE_MIN_ALBEDO);
+					continue;
+				}
+				glm::vec3 colour = glm::min(average, glm::vec3(1.0)) * 255.0f;
+				row[x - tile.fromX] = (uint32_t(colour.r) << 16) | (uint32_t(colour.g) << 8) | uint32_t(colour.b);
+			}
+			if (!denoiser) frameBuffer.writeSpan(y, tile.fromX, tile.toX, row.data());
+		}
+	});
+	std::chrono::duration<float> traceTime = std::chrono::steady_clock::now() - passStart;
+	if (denoiser) {
+		denoiser->filter();
+		getTileScheduler().forEachRow(height, RENDER_TILE_SIZE, [&](size_t y) {
+			std::vector<uint32_t> row(width);
+			for (size_t x = 0; x < width; x++) {
+				size_t index = y * denoiser->stride + x;
+				glm::vec3 colour;
+				for (int c = 0; c < 3; c++) colour[c] = std::min(denoiser->light[c][index] * std::max(denoiser->albedo[c][index], DENOISE_MIN_ALBEDO), 1.0f) * 255.0f;
+				row[x] = (uint32_t(colour.r) << 16) | (uint32_t(colour.g) << 8) | uint32_t(colour.b);
+			}
+			frameBuffer.writeSpan(int(y), 0, int(width), row.data());
+		});
+	}
+	report(traceTime);
+}
+
+bool PathTracer::findPrimaryHit(
+		int x,
+		int y,
+		const std::vector<ModelTriangle> &triangles,
+		const BVH &bvh,
+		const CameraEnvironment &cameraEnv,
+		const LightGrid &lightGrid,
+		float rayScaling,
+		glm::vec3 &point,
+		glm::vec3 &normal,
+		glm::vec3 &albedo) const {
+	float u = (float(x) - (width / 2)) * rayScaling;
+	float v = -1 * (float(y) - (height / 2)) * rayScaling;
+	glm::vec3 rayDirection = glm::normalize(cameraEnv.rotation * glm::vec3(u, v, -cameraEnv.focalLength));
+	BVHHit hit;
+	float lightDistance;
+	float lightCosine;
+	if (!bvh.intersect(cameraEnv.position, rayDirection, hit) || lightGrid.intersect(cameraEnv.position, rayDirection, hit.distance, lightDistance, lightCosine)) return false;
+	const Colour &colour = getHitColour(triangles, bvh, hit);
+	point = cameraEnv.position + hit.distance * rayDirection;
+	normal = getHitNormal(triangles, hit);
+	if (glm::dot(normal, rayDirection) > 0.0f) normal = -normal;
+	albedo = glm::vec3(colour.red, colour.green, colour.blue) / 255.0f;
+	return true;
+}
+
+void PathTracer::report(std::chrono::duration<float> passTime) {
+	reportedSamples += width * height;
+	reportedTime += passTime;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (now - lastReport < std::chrono::milliseconds(PATH_REPORT_INTERVAL) && !converged()) return;
+	std::cout << "Path tracing: " << history.stillFrames << " samples per pixel, " << reportedSamples / reportedTime.count() << " samples per second" << std::endl;
+	reportedSamples = 0;
+	reportedTime = std::chrono::duration<float>(0.0);
+	lastReport = now;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <chrono>
+#include <vector>
+#include "BVH.h"
+#include "CameraEnvironment.h"
+#include "Denoiser.h"
+#include "FrameBuffer.h"
+#include "Lights.h"
+#include "ModelTriangle.h"
+#include "Sampler.h"
+#include "TemporalHistory.h"
+
+// Share of the surface's reflection that goes into the glossy lobe rather than the diffuse one
+#define PATH_SPECULAR_WEIGHT 0.1f
+#define PATH_SPECULAR_EXPONENT 256.0f
+#define PATH_MAX_DEPTH 16
+// Paths at least this long are ended at random, more likely the less light they can still carry
+#define PATH_ROULETTE_DEPTH 3
+// Sample a light at every bounce as well as following the BSDF, weighting the two by multiple importance sampling
+#define PATH_LIGHT_SAMPLING true
+// A still view stops being refined once every pixel has this many samples
+#define PATH_MAX_SAMPLES 1024
+// Milliseconds between reports of how fast samples are being taken
+#define PATH_REPORT_INTERVAL 1000
+
+// Adds one path traced sample per pixel each time it renders and shows the running average
+// Starts again whenever reset() is called, when the camera moves the average is carried over by reprojection
+// With a denoiser the average is filtered before it's shown, guided by what each pixel's centre sees,
+// which is found again whenever the camera moves or the denoiser was last used for something else
+class PathTracer {
+public:
+	void reset();
+	bool converged() const;
+
+	// Samples are drawn from samplerType's sequence, without reprojection a moved camera starts over
+	void render(
+			FrameBuffer &frameBuffer,
+			const std::vector<ModelTriangle> &triangles,
+			const BVH &bvh,
+			const CameraEnvironment &cameraEnv,
+			const LightGrid &lightGrid,
+			SamplerType samplerType,
+			bool reprojection,
+			Denoiser *denoiser);
+
+private:
+	size_t width = 0;
+	size_t height = 0;
+	TemporalHistory history{PATH_MAX_SAMPLES};
+	bool guidesFound = false;
+	size_t reportedSamples = 0;
+	std::chrono::duration<float> reportedTime = std::chrono::duration<float>(0.0);
+	std::chrono::steady_clock::time_point lastReport = std::chrono::steady_clock::now();
+
+	// Where an unjittered ray through the pixel's centre first hits, along with the surface's normal and albedo there
+	// A pixel that sees a light first finds nothing, so the light's brightness isn't spread onto what's behind it
+	bool findPrimaryHit(
+			int x,
+			int y,
+			const std::vector<ModelTriangle> &triangles,
+			const BVH &bvh,
+			const CameraEnvironment &cameraEnv,
+			const LightGrid &lightGrid,
+			float rayScaling,
+			glm::vec3 &point,
+			glm::vec3 &normal,
+			glm::vec3 &albedo) const;
+
+	// Prints the rate over the passes since the last report, counting only time spent tracing
+	void report(std::chrono::duration<float> passTime);
+};
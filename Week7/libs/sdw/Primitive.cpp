@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cmath>
+#include "Primitive.h"
+
+Primitive Primitive::sphere(const glm::vec3 &centre, float radius, const Colour &colour) {
+	Primitive primitive;
+	primitive.type = SPHERE_PRIMITIVE;
+	primitive.colour = colour;
+	primitive.position = centre;
+	primitive.radius = radius;
+	return primitive;
+}
+
+Primitive Primitive::plane(const glm::vec3 &point, const glm::vec3 &normal, const Colour &colour) {
+	Primitive primitive;
+	primitive.type = PLANE_PRIMITIVE;
+	primitive.colour = colour;
+	primitive.position = point;
+	primitive.normal = glm::normalize(normal);
+	return primitive;
+}
+
+Primitive Primitive::box(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const Colour &colour) {
+	Primitive primitive;
+	primitive.type = BOX_PRIMITIVE;
+	primitive.colour = colour;
+	primitive.boundsMin = boundsMin;
+	primitive.boundsMax = boundsMax;
+	return primitive;
+}
+
+bool Primitive::isBounded() const {
+	return type != PLANE_PRIMITIVE;
+}
+
+void Primitive::getBounds(glm::vec3 &min, glm::vec3 &max) const {
+	if (type == SPHERE_PRIMITIVE) {
+		min = position - glm::vec3(radius);
+		max = position + glm::vec3(radius);
+	} else {
+		min = boundsMin;
+		max = boundsMax;
+	}
+}
+
+bool Primitive::intersect(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, float &distance) const {
+	if (type == SPHERE_PRIMITIVE) {
+		// |origin + t * direction - position|^2 = radius^2 with a unit direction, taking the nearer root in front
+		glm::vec3 offset = origin - position;
+		float b = glm::dot(offset, direction);
+		float c = glm::dot(offset, offset) - radius * radius;
+		float discriminant = b * b - c;
+		if (discriminant < 0.0f) return false;
+		float root = std::sqrt(discriminant);
+		float t = -b - root;
+		if (t <= 0.0f) t = -b + root;
+		if (t <= 0.0f || t >= maxDistance) return false;
+		distance = t;
+		return true;
+	}
+	if (type == PLANE_PRIMITIVE) {
+		float denominator = glm::dot(normal, direction);
+		if (std::abs(denominator) < 1e-9f) return false;
+		float t = glm::dot(position - origin, normal) / denominator;
+		if (t <= 0.0f || t >= maxDistance) return false;
+		distance = t;
+		return true;
+	}
+	// Slab test, leaving through the far side when starting inside
+	glm::vec3 inverseDirection = 1.0f / direction;
+	glm::vec3 t0 = (boundsMin - origin) * inverseDirection;
+	glm::vec3 t1 = (boundsMax - origin) * inverseDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float entry = std::max(std::max(tNear.x, tNear.y), tNear.z);
+	float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+	if (entry > exit) return false;
+	float t = (entry > 0.0f) ? entry : exit;
+	if (t <= 0.0f || t >= maxDistance) return false;
+	distance = t;
+	return true;
+}
+
+glm::vec3 Primitive::getNormal(const glm::vec3 &point) const {
+	if (type == SPHERE_PRIMITIVE) return (point - position) / radius;
+	if (type == PLANE_PRIMITIVE) return normal;
+	// The face the point is on is along the axis it's furthest out along, relative to the box's size
+	glm::vec3 centre = (boundsMin + boundsMax) * 0.5f;
+	glm::vec3 relative = (point - centre) / glm::max((boundsMax - boundsMin) * 0.5f, glm::vec3(1e-9f));
+	int axis = 0;
+	if (std::abs(relative.y) > std::abs(relative[axis])) axis = 1;
+	if (std::abs(relative.z) > std::abs(relative[axis])) axis = 2;
+	glm::vec3 faceNormal = glm::vec3(0.0);
+	faceNormal[axis] = (relative[axis] > 0.0f) ? 1.0f : -1.0f;
+	return faceNormal;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "Colour.h"
+
+// SPHERE_PRIMITIVE - radius around position
+// PLANE_PRIMITIVE - everything through position perpendicular to normal, with no edges
+// BOX_PRIMITIVE - the axis-aligned box from boundsMin to boundsMax
+enum PrimitiveType { SPHERE_PRIMITIVE, PLANE_PRIMITIVE, BOX_PRIMITIVE };
+
+// A shape intersected exactly rather than approximated with triangles, so a sphere is one test and shows no facets
+struct Primitive {
+	PrimitiveType type;
+	Colour colour;
+	glm::vec3 position{};
+	float radius{};
+	glm::vec3 normal{};
+	glm::vec3 boundsMin{};
+	glm::vec3 boundsMax{};
+
+	static Primitive sphere(const glm::vec3 &centre, float radius, const Colour &colour);
+	static Primitive plane(const glm::vec3 &point, const glm::vec3 &normal, const Colour &colour);
+	static Primitive box(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const Colour &colour);
+
+	// Planes go on forever, so they have no bounds and are kept out of bounding volume hierarchies
+	bool isBounded() const;
+	void getBounds(glm::vec3 &min, glm::vec3 &max) const;
+	// Nearest hit in (0, maxDistance) along a normalised direction, from inside as well as out
+	bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, float &distance) const;
+	// Outward unit normal at a point on the surface
+	glm::vec3 getNormal(const glm::vec3 &point) const;
+};
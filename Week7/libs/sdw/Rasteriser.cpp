@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include "Lights.h"
+#include "Rasteriser.h"
+
+uint32_t colourToCode(Colour colour){
+	return (colour.red << 16) + (colour.green << 8) + colour.blue;
+}
+
+static float interpolatePointDepth(CanvasPoint from, CanvasPoint to, CanvasPoint pointOnLine) {
+	assert(from.depth >= 0);
+	assert(to.depth >= 0);
+
+	float depthDiff = to.depth - from.depth;
+	float percentage = (pointOnLine.x - from.x) / (to.x - from.x);
+
+	// Resolves issues where dividing by a number close to 0 make percentage NaN
+	if (!std::isnormal(percentage)) {
+		assert(std::isnormal(from.depth));
+		return from.depth;
+	}
+	
+	float interpolatedDepth = from.depth + (percentage * depthDiff);
+	assert(interpolatedDepth >= 0);
+
+	return interpolatedDepth;
+}
+
+static void sortVerticies(std::array<CanvasPoint, 3UL> &verticies){
+	if (verticies[0].y > verticies[1].y){
+		std::swap(verticies[0], verticies[1]);
+	}
+	if (verticies[0].y > verticies[2].y){
+		std::swap(verticies[0], verticies[2]);
+	}
+	if (verticies[1].y > verticies[2].y){
+		std::swap(verticies[1], verticies[2]);
+	}
+}
+
+static CanvasPoint getIntersectionPoint(std::array<CanvasPoint, 3UL> &verticies){
+
+	assert(verticies[0].y <= verticies[1].y);
+	assert(verticies[1].y <= verticies[2].y);
+
+	float yPercentage = (verticies[1].y - verticies[0].y) / (verticies[2].y - verticies[0].y);
+	float xDiffVector = verticies[2].x - verticies[0].x;
+	float x = verticies[0].x + (yPercentage * xDiffVector);
+	return CanvasPoint(x, verticies[1].y);
+}
+
+static uint32_t getTexturePixelColour(const TextureMap &textureMap, float x, float y){
+	uint32_t index = std::round(y) * textureMap.width + std::round(x);
+	return textureMap.pixels[index];
+} 
+
+static TexturePoint interpolateIntoTextureMap(CanvasPoint from, CanvasPoint to, CanvasPoint pointOnLine) {
+	float xPercentage = (pointOnLine.x - from.x) / (to.x - from.x);
+	float yPercentage = (pointOnLine.x - from.x) / (to.x - from.x);
+	
+	// asserts pointOnLine is on the line between from and to
+	// Too sensitive to minute rounding errors?
+	// assert(xPercentage == yPercentage);
+
+	float texturePointXDiff = to.texturePoint.x - from.texturePoint.x;
+	float texturePointYDiff = to.texturePoint.y - from.texturePoint.y;
+	float interpolatedPointX = from.texturePoint.x + (xPercentage * texturePointXDiff);
+	float interpolatedPointY = from.texturePoint.y + (yPercentage * texturePointYDiff);
+
+	return TexturePoint(interpolatedPointX, interpolatedPointY);
+}
+
+// How far along the line pointOnLine is, measured along whichever axis the line covers most
+// so vertical triangle edges interpolate too
+static float getLinePercentage(CanvasPoint from, CanvasPoint to, CanvasPoint pointOnLine) {
+	float percentage;
+	if (std::abs(to.x - from.x) > std::abs(to.y - from.y)) percentage = (pointOnLine.x - from.x) / (to.x - from.x);
+	else percentage = (pointOnLine.y - from.y) / (to.y - from.y);
+	if (!std::isnormal(percentage)) percentage = 0.0;
+	return percentage;
+}
+
+static TexturePoint interpolateIntoLightmap(CanvasPoint from, CanvasPoint to, CanvasPoint pointOnLine) {
+	float percentage = getLinePercentage(from, to, pointOnLine);
+	float interpolatedPointX = from.lightmapPoint.x + percentage * (to.lightmapPoint.x - from.lightmapPoint.x);
+	float interpolatedPointY = from.lightmapPoint.y + percentage * (to.lightmapPoint.y - from.lightmapPoint.y);
+	return TexturePoint(interpolatedPointX, interpolatedPointY);
+}
+
+// Sets the normal and brightness of pointOnLine from those at the ends, for smooth shading
+static void interpolateShading(CanvasPoint from, CanvasPoint to, CanvasPoint &pointOnLine) {
+	float percentage = getLinePercentage(from, to, pointOnLine);
+	pointOnLine.normal = from.normal + percentage * (to.normal - from.normal);
+	pointOnLine.brightness = from.brightness + percentage * (to.brightness - from.brightness);
+}
+
+// Scales each channel of colourCode by the baked light, plus the same minimum the ray tracer uses
+static uint32_t applyLightmap(uint32_t colourCode, glm::vec3 light) {
+	glm::vec3 brightness = glm::min(light + MIN_BRIGHTNESS, glm::vec3(1.0));
+	uint32_t red = ((colourCode >> 16) & 0xFF) * brightness.r;
+	uint32_t green = ((colourCode >> 8) & 0xFF) * brightness.g;
+	uint32_t blue = (colourCode & 0xFF) * brightness.b;
+	return (colourCode & 0xFF000000) | (red << 16) | (green << 8) | blue;
+}
+
+// Lines are always horizontal here, so the span is written straight into the frame buffer's row
+static void drawTextureLine(
+		FrameBuffer &frameBuffer, 
+		CanvasPoint from, 
+		CanvasPoint to, 
+		const Material &material,
+		const Lightmap *lightmap,
+		GBuffer *gBuffer
+	){
+	int y = std::round(from.y);
+	if (y < 0 || y >= int(frameBuffer.height)) return;
+	if (to.x < from.x) std::swap(from, to);
+
+	// Clipped once for the whole span rather than per pixel
+	int fromX = std::max(int(std::round(from.x)), 0);
+	int toX = std::min(int(std::round(to.x)), int(frameBuffer.width) - 1);
+	if (fromX > toX) return;
+
+	uint32_t colourCode = 0;
+	if (material.type == COLOUR) colourCode = colourToCode(material.colour);
+
+	uint32_t *row = frameBuffer.getRow(y);
+	float *depthRow = frameBuffer.getDepthRow(y);
+	for (int x = fromX; x <= toX; x++) {
+		// Keeps interpolation within the line when rounding pushed the pixel just past an end
+		CanvasPoint point = CanvasPoint(std::min(std::max(float(x), from.x), to.x), from.y);
+		float depth = interpolatePointDepth(from, to, point);
+
+		if (depthRow[x] < depth){
+			if (material.type == TEXTURE) {
+				TexturePoint texturePoint = interpolateIntoTextureMap(from, to, point);
+				colourCode = getTexturePixelColour(material.textureMap, texturePoint.x, texturePoint.y);
+			}
+			if (lightmap) {
+				TexturePoint lightmapPoint = interpolateIntoLightmap(from, to, point);
+				row[x] = applyLightmap(colourCode, lightmap->sample(lightmapPoint.x / depth, lightmapPoint.y / depth));
+			} else row[x] = colourCode;
+			depthRow[x] = depth;
+			if (gBuffer && gBuffer->shadingModel != FLAT_SHADING) {
+				interpolateShading(from, to, point);
+				gBuffer->write(x, y, point.normal, point.brightness / depth);
+			} else if (gBuffer) gBuffer->write(x, y);
+		}
+	}
+}
+
+static void drawTopTextureTriangle(
+		FrameBuffer &frameBuffer, 
+		CanvasPoint top, 
+		CanvasPoint bottomLeftPoint, 
+		CanvasPoint bottomRightPoint,
+		const Material &material,
+		const Lightmap *lightmap,
+		GBuffer *gBuffer
+	){
+
+	assert(top.y <= bottomLeftPoint.y);
+	assert(top.y <= bottomRightPoint.y);
+	assert(bottomLeftPoint.x <= bottomRightPoint.x);
+	assert(bottomLeftPoint.y == bottomRightPoint.y);
+
+	float verticalSteps = bottomLeftPoint.y - top.y;
+
+	float leftStepDelta = (bottomLeftPoint.x - top.x) / verticalSteps;
+	float rightStepDelta = (bottomRightPoint.x - top.x) / verticalSteps;
+
+	float currentLeftX = top.x;
+	float currentRightX = top.x;
+
+	for (float y = top.y; y <= bottomLeftPoint.y; y++) {
+		CanvasPoint leftPoint = CanvasPoint(currentLeftX, y);
+		leftPoint.depth = interpolatePointDepth(top, bottomLeftPoint, leftPoint);
+
+		CanvasPoint rightPoint = CanvasPoint(currentRightX, y);
+		rightPoint.depth = interpolatePointDepth(top, bottomRightPoint, rightPoint);
+
+		if (material.type == TEXTURE){
+			leftPoint.texturePoint = interpolateIntoTextureMap(top, bottomLeftPoint, leftPoint);
+			rightPoint.texturePoint = interpolateIntoTextureMap(top, bottomRightPoint, rightPoint);
+		}
+
+		if (lightmap) {
+			leftPoint.lightmapPoint = interpolateIntoLightmap(top, bottomLeftPoint, leftPoint);
+			rightPoint.lightmapPoint = interpolateIntoLightmap(top, bottomRightPoint, rightPoint);
+		}
+
+		if (gBuffer && gBuffer->shadingModel != FLAT_SHADING) {
+			interpolateShading(top, bottomLeftPoint, leftPoint);
+			interpolateShading(top, bottomRightPoint, rightPoint);
+		}
+
+		drawTextureLine(frameBuffer, leftPoint, rightPoint, material, lightmap, gBuffer);
+
+		currentLeftX += leftStepDelta;
+		currentRightX += rightStepDelta;
+	}
+}
+
+static void drawBottomTextureTriangle(
+		FrameBuffer &frameBuffer, 
+		CanvasPoint bottom, 
+		CanvasPoint topLeftPoint, 
+		CanvasPoint topRightPoint,
+		const Material &material,
+		const Lightmap *lightmap,
+		GBuffer *gBuffer
+	){
+
+	assert(topLeftPoint.y <= bottom.y);
+	assert(topRightPoint.y <= bottom.y);
+	assert(topLeftPoint.x <= topRightPoint.x);
+	assert(topLeftPoint.y == topRightPoint.y);
+
+	float verticalSteps = bottom.y - topLeftPoint.y;
+
+	float leftStepDelta = (bottom.x - topLeftPoint.x) / verticalSteps;
+	float rightStepDelta = (bottom.x - topRightPoint.x) / verticalSteps;
+
+	float currentLeftX = topLeftPoint.x;
+	float currentRightX = topRightPoint.x;
+
+	for (float y = topLeftPoint.y; y <= bottom.y; y++) {
+		CanvasPoint leftPoint = CanvasPoint(currentLeftX, y);
+		leftPoint.depth = interpolatePointDepth(topLeftPoint, bottom, leftPoint);
+
+		CanvasPoint rightPoint = CanvasPoint(currentRightX, y);
+		rightPoint.depth = interpolatePointDepth(topRightPoint, bottom, rightPoint);
+
+		if (material.type == TEXTURE) {
+			leftPoint.texturePoint = interpolateIntoTextureMap(topLeftPoint, bottom, leftPoint);
+			rightPoint.texturePoint = interpolateIntoTextureMap(topRightPoint, bottom, rightPoint);
+		}
+
+		if (lightmap) {
+			leftPoint.lightmapPoint = interpolateIntoLightmap(topLeftPoint, bottom, leftPoint);
+			rightPoint.lightmapPoint = interpolateIntoLightmap(topRightPoint, bottom, rightPoint);
+		}
+
+		if (gBuffer && gBuffer->shadingModel != FLAT_SHADING) {
+			interpolateShading(topLeftPoint, bottom, leftPoint);
+			interpolateShading(topRightPoint, bottom, rightPoint);
+		}
+
+		drawTextureLine(frameBuffer, leftPoint, rightPoint, material, lightmap, gBuffer);
+		currentLeftX += leftStepDelta;
+		currentRightX += rightStepDelta;
+	}
+}
+
+void drawTextureMapTriangle(
+		FrameBuffer &frameBuffer, 
+		CanvasTriangle triangle, 
+		const Material &material,
+		const Lightmap *lightmap,
+		GBuffer *gBuffer
+	){
+
+	sortVerticies(triangle.vertices);
+	CanvasPoint top = triangle.vertices[0];
+	CanvasPoint middle = triangle.vertices[1];
+	CanvasPoint bottom = triangle.vertices[2];
+
+	CanvasPoint intersectionPoint = getIntersectionPoint(triangle.vertices);
+	intersectionPoint.depth = interpolatePointDepth(top, bottom, intersectionPoint);
+
+	if (material.type == TEXTURE) {
+		intersectionPoint.texturePoint = interpolateIntoTextureMap(top, bottom, intersectionPoint);
+	}
+
+	if (lightmap) {
+		intersectionPoint.lightmapPoint = interpolateIntoLightmap(top, bottom, intersectionPoint);
+	}
+
+	if (gBuffer && gBuffer->shadingModel != FLAT_SHADING) {
+		interpolateShading(top, bottom, intersectionPoint);
+	}
+
+	CanvasPoint leftPoint = middle;
+	CanvasPoint rightPoint = intersectionPoint;
+	if (rightPoint.x < leftPoint.x){
+		std::swap(leftPoint, rightPoint);
+	}
+
+	drawTopTextureTriangle(frameBuffer, top, leftPoint, rightPoint, material, lightmap, gBuffer);
+	drawBottomTextureTriangle(frameBuffer, bottom, leftPoint, rightPoint, material, lightmap, gBuffer);
+}
+
+void drawRasterisedModel(
+		FrameBuffer &frameBuffer,
+		const std::vector<ModelTriangle> &triangles,
+		const std::vector<Material> &materials,
+		const CameraEnvironment &cameraEnv,
+		const Lightmap *lightmap,
+		GBuffer *gBuffer
+	) {
+	for (int i = 0; i < triangles.size(); i++){
+		std::vector<CanvasPoint> verticies;
+		for (int j = 0; j < 3; j++){
+			glm::vec3 modelVertex = triangles[i].vertices[j];
+			CanvasPoint point = vertexToImagePlane(modelVertex, cameraEnv, frameBuffer);
+
+			if (materials[i].type == TEXTURE){
+				point.texturePoint = triangles[i].texturePoints[j];
+			}
+
+			if (lightmap) {
+				TexturePoint lightmapPoint = lightmap->coordinates[i][j];
+				point.lightmapPoint = TexturePoint(lightmapPoint.x * point.depth, lightmapPoint.y * point.depth);
+			}
+
+			// Multiplied by depth like the lightmap position, so they interpolate correctly under perspective
+			// Normals are turned to the side of the triangle the camera sees, as flat ones are when they're shaded
+			if (gBuffer && gBuffer->shadingModel != FLAT_SHADING) {
+				glm::vec3 normal = triangles[i].vertexNormals[j];
+				if (glm::dot(triangles[i].normal, modelVertex - cameraEnv.position) > 0.0f) normal = -normal;
+				point.normal = normal * point.depth;
+				if (gBuffer->shadingModel == GOURAUD_SHADING) point.brightness = gBuffer->vertexBrightnesses[i][j] * point.depth;
+			}
+
+			verticies.push_back(point);
+		}
+		CanvasTriangle triangle = CanvasTriangle(verticies[0], verticies[1], verticies[2]);
+		if (gBuffer) gBuffer->setTriangle(i, triangles[i].normal);
+		drawTextureMapTriangle(frameBuffer, triangle, materials[i], lightmap, gBuffer);
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "CameraEnvironment.h"
+#include "CanvasTriangle.h"
+#include "Colour.h"
+#include "FrameBuffer.h"
+#include "GBuffer.h"
+#include "Lightmap.h"
+#include "Material.h"
+#include "ModelTriangle.h"
+
+uint32_t colourToCode(Colour colour);
+
+// Fills the triangle, depth tested against frameBuffer's depth plane, which holds 1 / z
+// Lit by the lightmap if there is one, and with a G-buffer, what each pixel drawn sees is written to it as well
+void drawTextureMapTriangle(
+		FrameBuffer &frameBuffer,
+		CanvasTriangle triangle,
+		const Material &material,
+		const Lightmap *lightmap,
+		GBuffer *gBuffer);
+
+// Projects every triangle through the camera and draws it with its material, one per triangle
+void drawRasterisedModel(
+		FrameBuffer &frameBuffer,
+		const std::vector<ModelTriangle> &triangles,
+		const std::vector<Material> &materials,
+		const CameraEnvironment &cameraEnv,
+		const Lightmap *lightmap,
+		GBuffer *gBuffer);
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cmath>
+#include "RayTracing.h"
+#include "Utils.h"
+
+static Material PRIMITIVE_MATERIAL;
+
+int getStrataRows(int sampleCount) {
+	int rows = int(std::sqrt(float(sampleCount)));
+	while (sampleCount % rows != 0) rows--;
+	return rows;
+}
+
+bool isSceneTriangle(const BVHHit &hit) {
+	return hit.primitiveIndex < 0 && hit.instanceIndex < 0;
+}
+
+const Colour &getHitColour(const std::vector<ModelTriangle> &triangles, const BVH &bvh, const BVHHit &hit) {
+	if (hit.primitiveIndex >= 0) return bvh.getPrimitive(hit.primitiveIndex).colour;
+	if (hit.instanceIndex >= 0) return bvh.getInstance(hit.instanceIndex).mesh->triangles[hit.triangleIndex].colour;
+	return triangles[hit.triangleIndex].colour;
+}
+
+glm::vec3 getHitNormal(const std::vector<ModelTriangle> &triangles, const BVHHit &hit) {
+	return isSceneTriangle(hit) ? triangles[hit.triangleIndex].normal : hit.normal;
+}
+
+const Material &getHitMaterial(const std::vector<Material> &materials, const BVHHit &hit) {
+	return isSceneTriangle(hit) ? materials[hit.triangleIndex] : PRIMITIVE_MATERIAL;
+}
+
+float getSpecularCoefficient(glm::vec3 normal, glm::vec3 incidenceDirection, glm::vec3 viewDirection) {
+	glm::vec3 reflectionDirection = incidenceDirection - 2.0f * normal * glm::dot(normal, incidenceDirection);
+	float specularCoefficent = glm::dot(reflectionDirection, normal);
+	return pow256(specularCoefficent);
+}
+
+void getLightSample(const Sampler &sampler, uint32_t firstSample, uint32_t dimension, int i, int rows, int columns, float &s, float &t) {
+	glm::vec2 sample = sampler.get2D(firstSample * rows * columns + i, dimension);
+	if (sampler.type == WHITE_NOISE_SAMPLER) {
+		s = (float(i % columns) + sample.x) / columns;
+		t = (float(i / columns) + sample.y) / rows;
+	} else {
+		s = sample.x;
+		t = sample.y;
+	}
+}
+
+float getLightBrightness(
+		const BVH &bvh,
+		const AreaLight &light,
+		glm::vec3 point,
+		glm::vec3 normal,
+		glm::vec3 rayDirection,
+		const Sampler &sampler,
+		uint32_t firstSample,
+		uint32_t dimension,
+		float specularWeight) {
+	// Shadow rays leave from the side of the surface the camera sees
+	glm::vec3 facingNormal = (glm::dot(normal, rayDirection) < 0.0f) ? normal : -normal;
+	glm::vec3 shadowOrigin = point + facingNormal * SHADOW_BIAS;
+
+	int sampleCount = light.getSampleCount();
+	int rows = getStrataRows(sampleCount);
+	int columns = sampleCount / rows;
+	float diffuse = 0.0;
+	float specular = 0.0;
+	for (int i = 0; i < sampleCount; i++) {
+		float s;
+		float t;
+		getLightSample(sampler, firstSample, dimension, i, rows, columns, s, t);
+		glm::vec3 lightRay = light.samplePoint(point, s, t) - point;
+		float distanceToLight = glm::length(lightRay);
+		glm::vec3 normalisedLightRay = lightRay / distanceToLight;
+
+		float influence = light.getInfluence(distanceToLight);
+		float angleOfIncidence = std::max(glm::dot(normalisedLightRay, normal), 0.0f);
+		float sampleBrightness = BRIGHTNESS_SCALING / (distanceToLight * distanceToLight) * angleOfIncidence * influence;
+		float sampleSpecular = specularWeight * influence * getSpecularCoefficient(normal, -normalisedLightRay, -rayDirection);
+		// Shadows make no difference to a sample too faint to show up
+		if (sampleBrightness <= 0.0f && sampleSpecular < 0.001f) continue;
+
+		if (bvh.occluded(shadowOrigin, normalisedLightRay, distanceToLight - SHADOW_BIAS)) {
+			diffuse += sampleBrightness * SHADOW_FADE;
+		} else {
+			diffuse += sampleBrightness;
+			specular += sampleSpecular;
+		}
+	}
+	return (diffuse + specular) / sampleCount;
+}
+
+float getSceneBrightness(
+		const BVH &bvh,
+		const LightGrid &lightGrid,
+		glm::vec3 point,
+		glm::vec3 normal,
+		glm::vec3 rayDirection,
+		const Sampler &sampler,
+		uint32_t firstSample,
+		uint32_t firstDimension,
+		float specularWeight) {
+	size_t lightCount;
+	const uint32_t *lightIndices = lightGrid.getLightsAt(point, lightCount);
+	float brightness = 0.0;
+	for (size_t i = 0; i < lightCount; i++) {
+		const AreaLight &light = lightGrid.lights[lightIndices[i]];
+		// Grid cells are coarse, so each light is checked against the point itself too
+		if (glm::length(point - light.position) > light.getReach()) continue;
+		uint32_t dimension = firstDimension + 2 * lightIndices[i];
+		brightness += getLightBrightness(bvh, light, point, normal, rayDirection, sampler, firstSample, dimension, specularWeight);
+	}
+	return brightness;
+}
+
+// Schlick's approximation of the share of light reflected off glass rather than passing through it
+static float getFresnelReflectance(float cosine, float refractiveIndex) {
+	float r0 = (1.0f - refractiveIndex) / (1.0f + refractiveIndex);
+	r0 *= r0;
+	float complement = 1.0f - cosine;
+	float complementSquared = complement * complement;
+	return r0 + (1.0f - r0) * complementSquared * complementSquared * complement;
+}
+
+SecondaryRays::SecondaryRays(
+		const std::vector<ModelTriangle> &triangles,
+		const std::vector<Material> &materials,
+		const BVH &bvh,
+		const LightGrid &lightGrid,
+		const Sampler &sampler,
+		uint32_t firstSample) :
+	triangles(triangles), materials(materials), bvh(bvh), lightGrid(lightGrid), sampler(sampler), firstSample(firstSample),
+	raysLeft(MAX_SECONDARY_RAYS) {}
+
+glm::vec3 SecondaryRays::getSpecularColour(glm::vec3 normal, const Material &material, glm::vec3 point, glm::vec3 direction, int depth, float throughput) {
+	// Normals point out of closed glass, so a ray going the same way is leaving it
+	bool entering = glm::dot(normal, direction) < 0.0f;
+	glm::vec3 facingNormal = entering ? normal : -normal;
+	float eta = entering ? 1.0f / material.refractiveIndex : material.refractiveIndex;
+	// Zero when the ray is reflected entirely inside the glass
+	glm::vec3 refracted = glm::refract(direction, facingNormal, eta);
+	bool internallyReflected = glm::dot(refracted, refracted) == 0.0f;
+
+	// Fresnel uses the angle on the air side, which is the refracted ray's when leaving
+	float transparency = material.getTransparency();
+	float fresnel = 1.0;
+	if (!internallyReflected) {
+		float cosine = entering ? -glm::dot(direction, facingNormal) : -glm::dot(refracted, facingNormal);
+		fresnel = getFresnelReflectance(cosine, material.refractiveIndex);
+	}
+	float reflected = (1.0f - transparency) * material.getReflectivity() + transparency * fresnel;
+	float transmitted = transparency * (1.0f - fresnel);
+
+	glm::vec3 colour = glm::vec3(0.0);
+	if (reflected > 0.0f) {
+		glm::vec3 reflection = glm::reflect(direction, facingNormal);
+		colour += reflected * trace(point + facingNormal * SHADOW_BIAS, reflection, depth + 1, throughput * reflected);
+	}
+	if (transmitted > 0.0f) {
+		colour += transmitted * trace(point - facingNormal * SHADOW_BIAS, refracted, depth + 1, throughput * transmitted);
+	}
+	return colour;
+}
+
+glm::vec3 SecondaryRays::trace(glm::vec3 origin, glm::vec3 direction, int depth, float throughput) {
+	if (depth > MAX_RAY_DEPTH || throughput < MIN_RAY_THROUGHPUT || raysLeft <= 0) return glm::vec3(0.0);
+	raysLeft--;
+	BVHHit hit;
+	if (!bvh.intersect(origin, direction, hit)) return glm::vec3(0.0);
+
+	const Colour &hitColour = getHitColour(triangles, bvh, hit);
+	glm::vec3 normal = getHitNormal(triangles, hit);
+	const Material &material = getHitMaterial(materials, hit);
+	glm::vec3 point = origin + hit.distance * direction;
+	glm::vec3 colour = glm::vec3(0.0);
+	float diffuseShare = material.getDiffuseShare();
+	if (diffuseShare > 0.0f) {
+		float brightness = getSceneBrightness(bvh, lightGrid, point, normal, direction, sampler, firstSample, 0, 0.3f);
+		float scale = std::min(brightness + MIN_BRIGHTNESS, 1.0f);
+		colour += diffuseShare * scale * glm::vec3(hitColour.red, hitColour.green, hitColour.blue);
+	}
+	if (material.isSpecular()) colour += getSpecularColour(normal, material, point, direction, depth, throughput);
+	return colour;
+}
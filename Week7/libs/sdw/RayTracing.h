@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "BVH.h"
+#include "Colour.h"
+#include "Lights.h"
+#include "Material.h"
+#include "ModelTriangle.h"
+#include "Sampler.h"
+
+// Bounces off mirrors and through glass a ray can take before what it would see is left out
+#define MAX_RAY_DEPTH 6
+// Rays carrying less than this share of their pixel's colour aren't traced
+#define MIN_RAY_THROUGHPUT 0.01f
+// Most secondary rays traced for one pixel, so glass seen through glass can't split into a ray for every path
+#define MAX_SECONDARY_RAYS 24
+
+// Splits sampleCount strata into the most square rows x columns grid that uses all of them
+int getStrataRows(int sampleCount);
+
+// Whether the ray hit one of the scene's own triangles, rather than a primitive or a triangle of an instance
+bool isSceneTriangle(const BVHHit &hit);
+// What a ray hit, one of the triangles, one of the BVH's primitives or a triangle of one of its instances
+const Colour &getHitColour(const std::vector<ModelTriangle> &triangles, const BVH &bvh, const BVHHit &hit);
+glm::vec3 getHitNormal(const std::vector<ModelTriangle> &triangles, const BVHHit &hit);
+// Primitives and instances have no materials of their own, so they are all plain diffuse surfaces
+const Material &getHitMaterial(const std::vector<Material> &materials, const BVHHit &hit);
+
+float getSpecularCoefficient(glm::vec3 normal, glm::vec3 incidenceDirection, glm::vec3 viewDirection);
+
+// Point (s, t) in [0, 1)^2 for the i-th of rows x columns samples of a light, taken from the sampler at
+// sample firstSample * rows * columns + i and dimension
+// White noise is jittered within the i-th of rows x columns cells, the other samplers spread their points evenly already
+void getLightSample(const Sampler &sampler, uint32_t firstSample, uint32_t dimension, int i, int rows, int columns, float &s, float &t);
+
+// Diffuse and specular light reaching point, averaged over stratified samples of the light
+// Samples the light can't see through the scene are dimmed by SHADOW_FADE and lose their highlight
+float getLightBrightness(
+		const BVH &bvh,
+		const AreaLight &light,
+		glm::vec3 point,
+		glm::vec3 normal,
+		glm::vec3 rayDirection,
+		const Sampler &sampler,
+		uint32_t firstSample,
+		uint32_t dimension,
+		float specularWeight);
+
+// Light reaching point from every light whose influence gets that far
+// Each light takes its samples from its own pair of dimensions, starting at firstDimension
+float getSceneBrightness(
+		const BVH &bvh,
+		const LightGrid &lightGrid,
+		glm::vec3 point,
+		glm::vec3 normal,
+		glm::vec3 rayDirection,
+		const Sampler &sampler,
+		uint32_t firstSample,
+		uint32_t firstDimension,
+		float specularWeight);
+
+// Follows reflected and refracted rays from mirror and glass surfaces, shading whatever they reach as ray traced pixels are
+// Each branch is weighted by its share of the pixel's colour and dropped once that falls below MIN_RAY_THROUGHPUT,
+// and one pixel's rays stop at MAX_SECONDARY_RAYS however much the tree of them branches
+// Made for one pixel at a time, taking its light samples from that pixel's sampler
+class SecondaryRays {
+public:
+	SecondaryRays(
+			const std::vector<ModelTriangle> &triangles,
+			const std::vector<Material> &materials,
+			const BVH &bvh,
+			const LightGrid &lightGrid,
+			const Sampler &sampler,
+			uint32_t firstSample);
+
+	// Colour (0 to 255 per channel) a mirror or glass surface reflects and lets through along the ray that hit it,
+	// already scaled by the share of its light that goes that way rather than to its own colour
+	// depth counts the bounces before this one, throughput is the share of the pixel's colour that reached it
+	glm::vec3 getSpecularColour(glm::vec3 normal, const Material &material, glm::vec3 point, glm::vec3 direction, int depth, float throughput);
+
+private:
+	const std::vector<ModelTriangle> &triangles;
+	const std::vector<Material> &materials;
+	const BVH &bvh;
+	const LightGrid &lightGrid;
+	const Sampler &sampler;
+	uint32_t firstSample;
+	int raysLeft;
+
+	// Colour seen along the ray, black if it hits nothing or isn't worth tracing
+	glm::vec3 trace(glm::vec3 origin, glm::vec3 direction, int depth, float throughput);
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Lock-free single-producer/single-consumer ring buffer.
+// Exactly one thread may call push() and exactly one (other) thread may call pop().
+// Capacity must be a power of two; one slot is kept free to tell full from empty.
+template <typename T, size_t Capacity>
+class SPSCQueue {
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SPSCQueue capacity must be a power of two");
+
+public:
+	SPSCQueue() : head(0), tail(0) {}
+
+	// Returns false (and leaves the queue untouched) if the queue is full
+	bool push(const T &item) {
+		size_t currentTail = tail.load(std::memory_order_relaxed);
+		size_t nextTail = (currentTail + 1) & (Capacity - 1);
+		if (nextTail == head.load(std::memory_order_acquire)) return false;
+		items[currentTail] = item;
+		tail.store(nextTail, std::memory_order_release);
+		return true;
+	}
+
+	// Returns false if there was nothing to pop
+	bool pop(T &item) {
+		size_t currentHead = head.load(std::memory_order_relaxed);
+		if (currentHead == tail.load(std::memory_order_acquire)) return false;
+		item = items[currentHead];
+		head.store((currentHead + 1) & (Capacity - 1), std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+private:
+	// Producer and consumer indices live on separate cache lines so they don't false-share
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+	alignas(64) T items[Capacity];
+};
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Sampler.h"
+
+// The Sobol sequence is generated in groups of this many dimensions, with each group scrambled separately
+#define SOBOL_DIMENSIONS 4
+#define SOBOL_BITS 32
+// Width of the blurring used to measure how clustered the blue noise mask is, in pixels
+#define BLUE_NOISE_SIGMA 1.5f
+
+const char *getSamplerName(SamplerType type) {
+	if (type == WHITE_NOISE_SAMPLER) return "white noise";
+	if (type == SOBOL_SAMPLER) return "Sobol";
+	return "blue noise";
+}
+
+// Every output bit depends on every input bit (lowbias32)
+static uint32_t hashValue(uint32_t value) {
+	value ^= value >> 16;
+	value *= 0x7feb352du;
+	value ^= value >> 15;
+	value *= 0x846ca68bu;
+	value ^= value >> 16;
+	return value;
+}
+
+static uint32_t hashCombine(uint32_t seed, uint32_t value) {
+	return hashValue(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+// The top 24 bits as a float in [0, 1), so it never rounds up to 1
+static float toUnitFloat(uint32_t bits) {
+	return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// SOBOL
+
+// Direction numbers for the first SOBOL_DIMENSIONS dimensions, from the primitive polynomials in Joe and Kuo's table
+// Also tabulated a byte of the index at a time, so a point takes four lookups rather than one step per bit
+struct SobolMatrices {
+	uint32_t directions[SOBOL_DIMENSIONS][SOBOL_BITS];
+	uint32_t byteTables[SOBOL_DIMENSIONS][4][256];
+
+	SobolMatrices() {
+		const int degrees[SOBOL_DIMENSIONS] = {0, 1, 2, 3};
+		const uint32_t coefficients[SOBOL_DIMENSIONS] = {0, 0, 1, 1};
+		const uint32_t initial[SOBOL_DIMENSIONS][3] = {{0, 0, 0}, {1, 0, 0}, {1, 3, 0}, {1, 3, 1}};
+		for (int i = 0; i < SOBOL_BITS; i++) directions[0][i] = 1u << (31 - i);
+		for (int d = 1; d < SOBOL_DIMENSIONS; d++) {
+			int degree = degrees[d];
+			for (int i = 0; i < degree; i++) directions[d][i] = initial[d][i] << (31 - i);
+			for (int i = degree; i < SOBOL_BITS; i++) {
+				directions[d][i] = directions[d][i - degree] ^ (directions[d][i - degree] >> degree);
+				for (int k = 1; k < degree; k++) {
+					if ((coefficients[d] >> (degree - 1 - k)) & 1u) directions[d][i] ^= directions[d][i - k];
+				}
+			}
+		}
+		for (int d = 0; d < SOBOL_DIMENSIONS; d++) {
+			for (int byte = 0; byte < 4; byte++) {
+				for (uint32_t value = 0; value < 256; value++) {
+					uint32_t result = 0;
+					for (int bit = 0; bit < 8; bit++) {
+						if ((value >> bit) & 1u) result ^= directions[d][byte * 8 + bit];
+					}
+					byteTables[d][byte][value] = result;
+				}
+			}
+		}
+	}
+};
+
+static uint32_t getSobol(uint32_t index, uint32_t dimension) {
+	static const SobolMatrices matrices;
+	const uint32_t (&tables)[4][256] = matrices.byteTables[dimension];
+	return tables[0][index & 0xffu] ^ tables[1][(index >> 8) & 0xffu] ^ tables[2][(index >> 16) & 0xffu] ^ tables[3][index >> 24];
+}
+
+static uint32_t reverseBits(uint32_t value) {
+	value = ((value >> 1) & 0x55555555u) | ((value & 0x55555555u) << 1);
+	value = ((value >> 2) & 0x33333333u) | ((value & 0x33333333u) << 2);
+	value = ((value >> 4) & 0x0f0f0f0fu) | ((value & 0x0f0f0f0fu) << 4);
+	value = ((value >> 8) & 0x00ff00ffu) | ((value & 0x00ff00ffu) << 8);
+	return (value >> 16) | (value << 16);
+}
+
+// Owen scrambling by hashing (Laine and Karras, as refined by Burley)
+// Randomises the sequence while keeping how evenly its points are spread
+static uint32_t owenScramble(uint32_t value, uint32_t seed) {
+	value = reverseBits(value);
+	value += seed;
+	value ^= value * 0x6c50b47cu;
+	value ^= value * 0xb82f1e52u;
+	value ^= value * 0xc7afe638u;
+	value ^= value * 0x8d22f6e6u;
+	return reverseBits(value);
+}
+
+// Dimensions beyond the first SOBOL_DIMENSIONS reuse them with different scrambling, and the sample order is
+// shuffled per group too so that separate groups don't line up with each other
+static float getScrambledSobol(uint32_t sampleIndex, uint32_t dimension, uint32_t seed) {
+	uint32_t groupSeed = hashCombine(seed, dimension / SOBOL_DIMENSIONS);
+	uint32_t index = owenScramble(sampleIndex, groupSeed);
+	uint32_t bits = getSobol(index, dimension % SOBOL_DIMENSIONS);
+	return toUnitFloat(owenScramble(bits, hashCombine(groupSeed, dimension % SOBOL_DIMENSIONS)));
+}
+
+// BLUE NOISE
+
+// Toroidal distance between two coordinates on the mask
+static int wrappedDistance(int a, int b) {
+	int distance = std::abs(a - b);
+	return std::min(distance, BLUE_NOISE_SIZE - distance);
+}
+
+// Ranks every pixel of a tileable mask by void and cluster (Ulichney), so any threshold of it gives evenly spread pixels
+// Energy is each pixel's blurred closeness to the pixels already set: the highest set one is the tightest cluster,
+// the lowest unset one the largest void
+static std::vector<uint16_t> generateBlueNoise() {
+	const int pixelCount = BLUE_NOISE_SIZE * BLUE_NOISE_SIZE;
+	std::vector<float> kernel(pixelCount);
+	for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+		for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+			float squaredDistance = float(wrappedDistance(x, 0) * wrappedDistance(x, 0) + wrappedDistance(y, 0) * wrappedDistance(y, 0));
+			kernel[y * BLUE_NOISE_SIZE + x] = exp(-squaredDistance / (2.0f * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+		}
+	}
+
+	std::vector<bool> pattern(pixelCount, false);
+	std::vector<float> energy(pixelCount, 0.0f);
+	auto setPixel = [&](int pixel, bool value) {
+		pattern[pixel] = value;
+		float sign = value ? 1.0f : -1.0f;
+		int pixelX = pixel % BLUE_NOISE_SIZE;
+		int pixelY = pixel / BLUE_NOISE_SIZE;
+		for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+			int offsetY = (y - pixelY + BLUE_NOISE_SIZE) % BLUE_NOISE_SIZE;
+			for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+				int offsetX = (x - pixelX + BLUE_NOISE_SIZE) % BLUE_NOISE_SIZE;
+				energy[y * BLUE_NOISE_SIZE + x] += sign * kernel[offsetY * BLUE_NOISE_SIZE + offsetX];
+			}
+		}
+	};
+	auto findTightestCluster = [&]() {
+		int best = -1;
+		for (int i = 0; i < pixelCount; i++) {
+			if (pattern[i] && (best < 0 || energy[i] > energy[best])) best = i;
+		}
+		return best;
+	};
+	auto findLargestVoid = [&]() {
+		int best = -1;
+		for (int i = 0; i < pixelCount; i++) {
+			if (!pattern[i] && (best < 0 || energy[i] < energy[best])) best = i;
+		}
+		return best;
+	};
+
+	// Start from a tenth of the pixels at random, then move them out of clusters into voids until they settle
+	int initialCount = pixelCount / 10;
+	uint32_t state = 1;
+	for (int placed = 0; placed < initialCount;) {
+		state = hashValue(state);
+		int pixel = int(state % pixelCount);
+		if (pattern[pixel]) continue;
+		setPixel(pixel, true);
+		placed++;
+	}
+	while (true) {
+		int cluster = findTightestCluster();
+		setPixel(cluster, false);
+		int largestVoid = findLargestVoid();
+		setPixel(largestVoid, true);
+		if (largestVoid == cluster) break;
+	}
+
+	std::vector<uint16_t> ranks(pixelCount);
+	std::vector<bool> initialPattern = pattern;
+	std::vector<float> initialEnergy = energy;
+	// Take the initial pixels away from the most clustered down, ranking them last to first
+	for (int rank = initialCount - 1; rank >= 0; rank--) {
+		int cluster = findTightestCluster();
+		setPixel(cluster, false);
+		ranks[cluster] = uint16_t(rank);
+	}
+	// Then fill in from the initial pattern, always into the largest void
+	pattern = initialPattern;
+	energy = initialEnergy;
+	for (int rank = initialCount; rank < pixelCount; rank++) {
+		int largestVoid = findLargestVoid();
+		setPixel(largestVoid, true);
+		ranks[largestVoid] = uint16_t(rank);
+	}
+	return ranks;
+}
+
+// Generated the first time it's needed, which takes under a tenth of a second
+static float getBlueNoise(int x, int y) {
+	static const std::vector<uint16_t> ranks = generateBlueNoise();
+	int index = (y & (BLUE_NOISE_SIZE - 1)) * BLUE_NOISE_SIZE + (x & (BLUE_NOISE_SIZE - 1));
+	return (ranks[index] + 0.5f) / (BLUE_NOISE_SIZE * BLUE_NOISE_SIZE);
+}
+
+// SAMPLER
+
+Sampler::Sampler(SamplerType type, int x, int y) :
+	type(type), x(x), y(y), pixelSeed(hashCombine(hashValue(uint32_t(x)), uint32_t(y))), currentSample(0), currentDimension(0) {}
+
+float Sampler::get1D(uint32_t sampleIndex, uint32_t dimension) const {
+	if (type == SOBOL_SAMPLER) return getScrambledSobol(sampleIndex, dimension, pixelSeed);
+	if (type == BLUE_NOISE_SAMPLER) {
+		// Each dimension reads the mask at a different offset so dimensions don't share their pattern
+		uint32_t offset = hashValue(dimension + 1);
+		float shift = getBlueNoise(x + int(offset % BLUE_NOISE_SIZE), y + int((offset / BLUE_NOISE_SIZE) % BLUE_NOISE_SIZE));
+		float value = getScrambledSobol(sampleIndex, dimension, 0) + shift;
+		return (value < 1.0f) ? value : value - 1.0f;
+	}
+	return toUnitFloat(hashCombine(hashCombine(pixelSeed, sampleIndex), dimension));
+}
+
+glm::vec2 Sampler::get2D(uint32_t sampleIndex, uint32_t dimension) const {
+	return glm::vec2(get1D(sampleIndex, dimension), get1D(sampleIndex, dimension + 1));
+}
+
+void Sampler::startSample(uint32_t sampleIndex) {
+	currentSample = sampleIndex;
+	currentDimension = 0;
+}
+
+float Sampler::next1D() {
+	return get1D(currentSample, currentDimension++);
+}
+
+glm::vec2 Sampler::next2D() {
+	currentDimension += currentDimension & 1u;
+	glm::vec2 sample = get2D(currentSample, currentDimension);
+	currentDimension += 2;
+	return sample;
+}
+
+void getTangentBasis(glm::vec3 normal, glm::vec3 &tangent, glm::vec3 &bitangent) {
+	glm::vec3 helper = (std::abs(normal.y) < 0.9f) ? glm::vec3(0.0, 1.0, 0.0) : glm::vec3(1.0, 0.0, 0.0);
+	tangent = glm::normalize(glm::cross(helper, normal));
+	bitangent = glm::cross(normal, tangent);
+}
+
+glm::vec3 sampleCosineHemisphere(glm::vec3 normal, float s, float t) {
+	glm::vec3 tangent;
+	glm::vec3 bitangent;
+	getTangentBasis(normal, tangent, bitangent);
+	float r = std::sqrt(s);
+	float theta = 2.0f * M_PI * t;
+	return r * std::cos(theta) * tangent + r * std::sin(theta) * bitangent + float(std::sqrt(std::max(1.0f - s, 0.0f))) * normal;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+
+// Side length in pixels of the blue noise mask, which tiles the image
+#define BLUE_NOISE_SIZE 64
+
+// WHITE_NOISE_SAMPLER - independent random numbers from a counter based hash, cheapest but clumpiest
+// SOBOL_SAMPLER - a Sobol sequence with its own Owen scrambling per pixel, converging fastest as samples build up
+// BLUE_NOISE_SAMPLER - one scrambled Sobol sequence offset per pixel by a blue noise mask,
+// so the error left at low sample counts is fine grained noise rather than blotches
+enum SamplerType { WHITE_NOISE_SAMPLER, SOBOL_SAMPLER, BLUE_NOISE_SAMPLER };
+
+const char *getSamplerName(SamplerType type);
+
+// Numbers in [0, 1) for the sample points of one pixel, each one picked out by a sample index and a dimension
+// Every value depends only on the pixel, sample index and dimension, never on which thread asks or in what order,
+// so images come out the same whatever the thread count
+// Pairs of dimensions starting on an even one are spread evenly over [0, 1)^2 by the low discrepancy samplers
+class Sampler {
+public:
+	SamplerType type;
+
+	Sampler(SamplerType type, int x, int y);
+
+	float get1D(uint32_t sampleIndex, uint32_t dimension) const;
+	glm::vec2 get2D(uint32_t sampleIndex, uint32_t dimension) const;
+
+	// Steps through the dimensions of one sample in turn, for code that uses a varying number of them
+	void startSample(uint32_t sampleIndex);
+	float next1D();
+	// Starts on the next even dimension so the pair is evenly spread
+	glm::vec2 next2D();
+
+private:
+	int x;
+	int y;
+	uint32_t pixelSeed;
+	uint32_t currentSample;
+	uint32_t currentDimension;
+};
+
+// Two unit vectors perpendicular to normal and each other
+void getTangentBasis(glm::vec3 normal, glm::vec3 &tangent, glm::vec3 &bitangent);
+// Directions about normal with probability proportional to the cosine with it, for (s, t) in [0, 1)^2
+glm::vec3 sampleCosineHemisphere(glm::vec3 normal, float s, float t);
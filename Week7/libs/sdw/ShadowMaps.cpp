@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cmath>
+#include "CanvasTriangle.h"
+#include "Material.h"
+#include "Rasteriser.h"
+#include "ShadowMaps.h"
+#include "TileScheduler.h"
+
+// Camera rotation for looking out of a cube from its centre along +x, -x, +y, -y, +z or -z, the face's major axis
+// Set up like CameraEnvironment::lookAt, so faces render with the usual pipeline
+static glm::mat3 getCubeFaceRotation(int face) {
+	glm::vec3 direction = glm::vec3(0.0);
+	direction[face / 2] = (face % 2 == 0) ? 1.0 : -1.0;
+	glm::vec3 forward = -direction;
+	glm::vec3 vertical = (face / 2 == 1) ? glm::vec3(0.0, 0.0, 1.0) : glm::vec3(0.0, 1.0, 0.0);
+	glm::vec3 right = glm::normalize(glm::cross(vertical, forward));
+	glm::vec3 up = glm::cross(forward, right);
+	return glm::mat3(right, up, forward);
+}
+
+// The part of the triangle in front of the near plane, as a convex polygon of up to four vertices
+static std::vector<glm::vec3> clipToNearPlane(const ModelTriangle &triangle, const CameraEnvironment &faceCamera) {
+	glm::vec3 forward = -faceCamera.rotation[2];
+	std::vector<glm::vec3> polygon;
+	for (int i = 0; i < 3; i++) {
+		glm::vec3 current = triangle.vertices[i];
+		glm::vec3 next = triangle.vertices[(i + 1) % 3];
+		float currentDepth = glm::dot(current - faceCamera.position, forward) - SHADOW_MAP_NEAR;
+		float nextDepth = glm::dot(next - faceCamera.position, forward) - SHADOW_MAP_NEAR;
+		if (currentDepth >= 0.0f) polygon.push_back(current);
+		if ((currentDepth >= 0.0f) != (nextDepth >= 0.0f)) {
+			polygon.push_back(current + (next - current) * (currentDepth / (currentDepth - nextDepth)));
+		}
+	}
+	return polygon;
+}
+
+void CubeShadowMap::renderFace(const std::vector<ModelTriangle> &triangles, int face) {
+	FrameBuffer &target = faces[face];
+	if (target.width != size_t(SHADOW_MAP_SIZE)) target = FrameBuffer(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+	target.clearDepth(0.0);
+	// Square 90 degree view, so the face's edges meet its neighbours'
+	CameraEnvironment &faceCamera = faceCameras[face];
+	faceCamera.position = position;
+	faceCamera.rotation = getCubeFaceRotation(face);
+	faceCamera.focalLength = SHADOW_MAP_SIZE / (2.0f * getPlaneScaling(target));
+	Material depthMaterial;
+	depthMaterial.setColour(Colour(255, 255, 255));
+	for (size_t i = 0; i < triangles.size(); i++) {
+		std::vector<glm::vec3> polygon = clipToNearPlane(triangles[i], faceCamera);
+		for (size_t j = 2; j < polygon.size(); j++) {
+			CanvasTriangle triangle = CanvasTriangle(
+				vertexToImagePlane(polygon[0], faceCamera, target),
+				vertexToImagePlane(polygon[j - 1], faceCamera, target),
+				vertexToImagePlane(polygon[j], faceCamera, target)
+			);
+			drawTextureMapTriangle(target, triangle, depthMaterial, nullptr, nullptr);
+		}
+	}
+}
+
+float CubeShadowMap::getVisibility(glm::vec3 point, glm::vec3 normal) const {
+	glm::vec3 offset = point - position;
+	float distance = glm::length(offset);
+	// About a texel's width at that distance
+	float texelSize = 2.0f * distance / SHADOW_MAP_SIZE;
+	offset += normal * (SHADOW_MAP_NORMAL_OFFSET * texelSize);
+
+	glm::vec3 magnitude = glm::abs(offset);
+	int axis = (magnitude.x >= magnitude.y && magnitude.x >= magnitude.z) ? 0 : (magnitude.y >= magnitude.z) ? 1 : 2;
+	int face = 2 * axis + ((offset[axis] >= 0.0f) ? 0 : 1);
+	const FrameBuffer &target = faces[face];
+	CanvasPoint projected = vertexToImagePlane(position + offset, faceCameras[face], target);
+	float pointDepth = 1.0f / projected.depth;
+
+	int centreX = int(std::round(projected.x));
+	int centreY = int(std::round(projected.y));
+	int lit = 0;
+	int taps = 0;
+	for (int y = centreY - SHADOW_MAP_PCF_RADIUS; y <= centreY + SHADOW_MAP_PCF_RADIUS; y++) {
+		const float *depthRow = target.getDepthRow(std::min(std::max(y, 0), SHADOW_MAP_SIZE - 1));
+		for (int x = centreX - SHADOW_MAP_PCF_RADIUS; x <= centreX + SHADOW_MAP_PCF_RADIUS; x++) {
+			float occluderDepth = depthRow[std::min(std::max(x, 0), SHADOW_MAP_SIZE - 1)];
+			// Nothing drawn there means nothing in the way
+			if (occluderDepth <= 0.0f || pointDepth * (1.0f - SHADOW_MAP_BIAS) <= 1.0f / occluderDepth) lit++;
+			taps++;
+		}
+	}
+	return float(lit) / taps;
+}
+
+void ShadowMaps::update(const std::vector<ModelTriangle> &triangles, const std::vector<AreaLight> &lights) {
+	maps.resize(std::min(lights.size(), size_t(MAX_SHADOWED_LIGHTS)));
+	std::vector<size_t> stale;
+	for (size_t i = 0; i < maps.size(); i++) {
+		bool current = SHADOW_MAP_CACHING && maps[i].rendered && maps[i].position == lights[i].position;
+		if (current) continue;
+		maps[i].position = lights[i].position;
+		maps[i].rendered = true;
+		stale.push_back(i);
+	}
+	getTileScheduler().parallelFor(stale.size() * 6, [&](size_t i) {
+		maps[stale[i / 6]].renderFace(triangles, int(i % 6));
+	});
+}
+
+void ShadowMaps::invalidate() {
+	for (size_t i = 0; i < maps.size(); i++) maps[i].rendered = false;
+}
+
+float ShadowMaps::getVisibility(size_t light, glm::vec3 point, glm::vec3 normal) const {
+	if (light >= maps.size()) return 1.0;
+	return maps[light].getVisibility(point, normal);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "CameraEnvironment.h"
+#include "FrameBuffer.h"
+#include "Lights.h"
+#include "ModelTriangle.h"
+
+// Pixels along each side of a cube map face
+#define SHADOW_MAP_SIZE 256
+// Only the first this many lights in the scene cast shadows, the rest light everything
+#define MAX_SHADOWED_LIGHTS 4
+// Shadow maps are only drawn again when their light moves
+#define SHADOW_MAP_CACHING true
+// Depth tests are averaged over a square this many texels either side of the one looked up (percentage closer filtering)
+#define SHADOW_MAP_PCF_RADIUS 1
+// Triangles are clipped this far in front of the light, so nothing behind a face is projected onto it
+#define SHADOW_MAP_NEAR 0.01f
+// Points are looked up this many texels off their surface, and count as lit unless this fraction further away
+// than what the light sees, so surfaces don't shadow themselves
+#define SHADOW_MAP_NORMAL_OFFSET 3.0f
+#define SHADOW_MAP_BIAS 0.01f
+
+// Depth of everything around a point light, drawn by the rasteriser into six 90 degree faces
+// Only the depth plane is used, which holds 1 / z as for any rasterised frame
+class CubeShadowMap {
+public:
+	glm::vec3 position;
+	bool rendered = false;
+
+	// Each face is drawn separately, so faces can be shared out over the tile scheduler
+	void renderFace(const std::vector<ModelTriangle> &triangles, int face);
+
+	// Share of the light's depth tests the point passes, from 0 in full shadow to 1 fully lit
+	float getVisibility(glm::vec3 point, glm::vec3 normal) const;
+
+private:
+	FrameBuffer faces[6];
+	CameraEnvironment faceCameras[6];
+};
+
+// A cube shadow map for each of the first MAX_SHADOWED_LIGHTS lights
+class ShadowMaps {
+public:
+	// Draws any map that is out of date, or every map without SHADOW_MAP_CACHING
+	void update(const std::vector<ModelTriangle> &triangles, const std::vector<AreaLight> &lights);
+
+	// Every map is redrawn next time, for when the triangles have moved
+	void invalidate();
+
+	float getVisibility(size_t light, glm::vec3 point, glm::vec3 normal) const;
+
+private:
+	std::vector<CubeShadowMap> maps;
+};
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cmath>
+#include "TemporalHistory.h"
+
+TemporalHistory::TemporalHistory(int maxHistory) : maxHistory(maxHistory) {}
+
+void TemporalHistory::reset() {
+	frameCount = 0;
+	stillFrames = 0;
+	std::fill(counts.begin(), counts.end(), 0);
+}
+
+bool TemporalHistory::converged() const {
+	return stillFrames >= maxHistory;
+}
+
+bool TemporalHistory::beginFrame(size_t frameWidth, size_t frameHeight, const CameraEnvironment &cameraEnv, float rayScaling, bool reprojection) {
+	frame = frameCount++;
+	bool moved = frameWidth != width || frameHeight != height || rayScaling != currentRayScaling ||
+		cameraEnv.position != camera.position || cameraEnv.rotation != camera.rotation || cameraEnv.focalLength != camera.focalLength;
+	if (!moved) {
+		stillFrames++;
+		return false;
+	}
+	stillFrames = 1;
+	std::swap(radiance, previousRadiance);
+	std::swap(distances, previousDistances);
+	std::swap(normals, previousNormals);
+	std::swap(counts, previousCounts);
+	if (!reprojection) std::fill(previousCounts.begin(), previousCounts.end(), 0);
+	previousCamera = camera;
+	previousWidth = width;
+	previousHeight = height;
+	previousRayScaling = currentRayScaling;
+	camera = cameraEnv;
+	width = frameWidth;
+	height = frameHeight;
+	currentRayScaling = rayScaling;
+	radiance.resize(width * height);
+	distances.resize(width * height);
+	normals.resize(width * height);
+	counts.assign(width * height, 0);
+	return true;
+}
+
+void TemporalHistory::reproject(size_t x, size_t y, glm::vec3 point, glm::vec3 surfaceNormal) {
+	size_t index = y * width + x;
+	distances[index] = glm::length(point - camera.position);
+	normals[index] = surfaceNormal;
+	radiance[index] = glm::vec3(0.0);
+	counts[index] = 0;
+
+	// The inverse of how the ray tracers turn a pixel into a ray direction
+	glm::vec3 offset = glm::transpose(previousCamera.rotation) * (point - previousCamera.position);
+	if (offset.z >= 0.0f || previousWidth == 0) return;
+	float scale = -previousCamera.focalLength / (offset.z * previousRayScaling);
+	float previousX = offset.x * scale + float(previousWidth / 2);
+	float previousY = -offset.y * scale + float(previousHeight / 2);
+	int x0 = int(std::floor(previousX));
+	int y0 = int(std::floor(previousY));
+	float tx = previousX - x0;
+	float ty = previousY - y0;
+	float expectedDistance = glm::length(point - previousCamera.position);
+
+	glm::vec3 total = glm::vec3(0.0);
+	float totalWeight = 0.0f;
+	int historyCount = TEMPORAL_MOTION_HISTORY;
+	for (int j = 0; j < 2; j++) {
+		for (int i = 0; i < 2; i++) {
+			int tapX = x0 + i;
+			int tapY = y0 + j;
+			float weight = (i ? tx : 1.0f - tx) * (j ? ty : 1.0f - ty);
+			if (weight <= 0.0f || tapX < 0 || tapY < 0 || tapX >= int(previousWidth) || tapY >= int(previousHeight)) continue;
+			size_t tap = tapY * previousWidth + tapX;
+			if (previousCounts[tap] == 0) continue;
+			if (std::abs(previousDistances[tap] - expectedDistance) > TEMPORAL_DEPTH_TOLERANCE * expectedDistance) continue;
+			if (glm::dot(previousNormals[tap], surfaceNormal) < TEMPORAL_NORMAL_TOLERANCE) continue;
+			total += weight * previousRadiance[tap];
+			totalWeight += weight;
+			historyCount = std::min(historyCount, previousCounts[tap]);
+		}
+	}
+	// A sliver of one valid pixel isn't worth keeping
+	if (totalWeight < 0.01f) return;
+	radiance[index] = total / totalWeight;
+	counts[index] = historyCount;
+}
+
+void TemporalHistory::clear(size_t x, size_t y) {
+	size_t index = y * width + x;
+	distances[index] = 0.0f;
+	normals[index] = glm::vec3(0.0);
+	radiance[index] = glm::vec3(0.0);
+	counts[index] = 0;
+}
+
+glm::vec3 TemporalHistory::accumulate(size_t x, size_t y, glm::vec3 sample) {
+	size_t index = y * width + x;
+	int &count = counts[index];
+	count = std::min(count + 1, maxHistory);
+	radiance[index] += (sample - radiance[index]) / float(count);
+	return radiance[index];
+}
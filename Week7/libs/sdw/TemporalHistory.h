@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "CameraEnvironment.h"
+
+// Frames of history a pixel keeps when the camera moves, so new samples always make up at least 1 / (this + 1)
+// of what's shown and anything smeared by reprojecting fades within a few frames
+#define TEMPORAL_MOTION_HISTORY 8
+// History is only reused where the previous frame saw a surface within this fraction of the expected distance,
+// facing at least this close (as a cosine) to the same way
+#define TEMPORAL_DEPTH_TOLERANCE 0.05f
+#define TEMPORAL_NORMAL_TOLERANCE 0.9f
+
+// Running average of every pixel's samples, carried from frame to frame
+// While the camera is still new samples are averaged in place, once it moves each pixel's primary hit is projected
+// into the previous frame and the average there is taken over if that pixel saw the same surface
+// Call beginFrame() before each frame, then reproject() or clear() every pixel if it returns true, then accumulate()
+class TemporalHistory {
+public:
+	// Index of the frame being rendered since the last reset, so every frame can take different samples
+	uint32_t frame = 0;
+	// Frames rendered in a row without the camera moving
+	int stillFrames = 0;
+
+	explicit TemporalHistory(int maxHistory);
+
+	void reset();
+	bool converged() const;
+
+	// Returns true if the camera or frame size has changed since the last frame, in which case every pixel
+	// starts empty until it is reprojected
+	// Without reprojection a moved camera starts over, so reproject() finds no history
+	bool beginFrame(size_t frameWidth, size_t frameHeight, const CameraEnvironment &cameraEnv, float rayScaling, bool reprojection);
+
+	// Takes over the history of the surface at point from the previous frame, as a bilinear blend of the four
+	// previous pixels around where it was, leaving out any of them that saw something else
+	void reproject(size_t x, size_t y, glm::vec3 point, glm::vec3 surfaceNormal);
+	// For a pixel that sees nothing worth keeping history for, so nothing is reprojected onto it later
+	void clear(size_t x, size_t y);
+	// Averages sample into the pixel's history and returns the result
+	glm::vec3 accumulate(size_t x, size_t y, glm::vec3 sample);
+
+private:
+	int maxHistory;
+	uint32_t frameCount = 0;
+	CameraEnvironment camera = CameraEnvironment();
+	size_t width = 0;
+	size_t height = 0;
+	float currentRayScaling = 0.0f;
+	std::vector<glm::vec3> radiance;
+	// Distance along the camera ray to what each pixel's centre sees, 0 where that's nothing
+	std::vector<float> distances;
+	std::vector<glm::vec3> normals;
+	// Samples in each pixel's average, 0 where it has no history
+	std::vector<int> counts;
+
+	CameraEnvironment previousCamera = CameraEnvironment();
+	size_t previousWidth = 0;
+	size_t previousHeight = 0;
+	float previousRayScaling = 0.0f;
+	std::vector<glm::vec3> previousRadiance;
+	std::vector<float> previousDistances;
+	std::vector<glm::vec3> previousNormals;
+	std::vector<int> previousCounts;
+};
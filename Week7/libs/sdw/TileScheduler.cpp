@@ -0,0 +1,110 @@
+#include <algorithm>
+#include "TileScheduler.h"
+
+// Set on threads that are currently running a body, so nested calls don't wait on themselves
+static thread_local bool insideJob = false;
+
+TileScheduler::TileScheduler() : TileScheduler(std::max(std::thread::hardware_concurrency(), 1u)) {}
+
+// threadCount includes the calling thread, so one fewer worker is started
+TileScheduler::TileScheduler(size_t threadCount) :
+		job(nullptr),
+		jobSize(0),
+		jobGeneration(0),
+		nextIndex(0),
+		activeWorkers(0),
+		stopping(false) {
+	for (size_t i = 1; i < threadCount; i++) workers.push_back(std::thread(&TileScheduler::workerLoop, this));
+}
+
+TileScheduler::~TileScheduler() {
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		stopping = true;
+	}
+	jobStarted.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+size_t TileScheduler::threadCount() const {
+	return workers.size() + 1;
+}
+
+void TileScheduler::runJob(const std::function<void(size_t)> &body, size_t count) {
+	insideJob = true;
+	size_t i;
+	while ((i = nextIndex.fetch_add(1)) < count) body(i);
+	insideJob = false;
+}
+
+void TileScheduler::workerLoop() {
+	size_t seenGeneration = 0;
+	while (true) {
+		const std::function<void(size_t)> *body;
+		size_t count;
+		{
+			std::unique_lock<std::mutex> lock(jobMutex);
+			jobStarted.wait(lock, [&] { return stopping || jobGeneration != seenGeneration; });
+			if (stopping) return;
+			seenGeneration = jobGeneration;
+			body = job;
+			count = jobSize;
+		}
+		runJob(*body, count);
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			activeWorkers--;
+			if (activeWorkers == 0) jobFinished.notify_one();
+		}
+	}
+}
+
+void TileScheduler::parallelFor(size_t count, const std::function<void(size_t)> &body) {
+	if (count == 0) return;
+	if (workers.empty() || count == 1 || insideJob) {
+		for (size_t i = 0; i < count; i++) body(i);
+		return;
+	}
+	std::lock_guard<std::mutex> callerLock(callerMutex);
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		job = &body;
+		jobSize = count;
+		nextIndex = 0;
+		activeWorkers = workers.size();
+		jobGeneration++;
+	}
+	jobStarted.notify_all();
+	runJob(body, count);
+
+	// body must outlive every worker's use of it
+	std::unique_lock<std::mutex> lock(jobMutex);
+	jobFinished.wait(lock, [&] { return activeWorkers == 0; });
+	job = nullptr;
+}
+
+void TileScheduler::forEachTile(int width, int height, int tileSize, const std::function<void(const Tile &)> &drawTile) {
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+	parallelFor(tilesX * tilesY, [&](size_t i) {
+		Tile tile;
+		tile.fromX = (int(i) % tilesX) * tileSize;
+		tile.fromY = (int(i) / tilesX) * tileSize;
+		tile.toX = std::min(tile.fromX + tileSize, width);
+		tile.toY = std::min(tile.fromY + tileSize, height);
+		drawTile(tile);
+	});
+}
+
+void TileScheduler::forEachRow(size_t height, size_t bandHeight, const std::function<void(size_t)> &drawRow) {
+	parallelFor((height + bandHeight - 1) / bandHeight, [&](size_t band) {
+		size_t toY = std::min((band + 1) * bandHeight, height);
+		for (size_t y = band * bandHeight; y < toY; y++) drawRow(y);
+	});
+}
+
+TileScheduler &getTileScheduler() {
+	// Deliberately never destroyed, so workers are not joined while the process exits mid-frame
+	static TileScheduler *scheduler = new TileScheduler();
+	return *scheduler;
+}
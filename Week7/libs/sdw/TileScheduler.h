@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Side length in pixels of the squares an image is split into for parallel rendering
+// Matches DIRTY_TILE_SIZE so each dirty flag is only ever written by one thread
+#define RENDER_TILE_SIZE 32
+
+// Half-open pixel rectangle [fromX, toX) x [fromY, toY)
+struct Tile {
+	int fromX;
+	int fromY;
+	int toX;
+	int toY;
+};
+
+// A fixed pool of worker threads that share out independent pieces of work
+// The calling thread joins in, and each call returns once every piece is finished
+class TileScheduler {
+public:
+	TileScheduler();
+	explicit TileScheduler(size_t threadCount);
+	~TileScheduler();
+
+	size_t threadCount() const;
+	// Calls body(i) for every i in [0, count), in no particular order
+	// Calls made from inside a body run serially on that thread rather than deadlocking
+	void parallelFor(size_t count, const std::function<void(size_t)> &body);
+	// Calls drawTile for every tileSize square covering a width x height image
+	void forEachTile(int width, int height, int tileSize, const std::function<void(const Tile &)> &drawTile);
+	// Calls drawRow for every row of an image height rows tall, each thread taking whole bands of bandHeight rows
+	// Use RENDER_TILE_SIZE bands when the rows are written to a FrameBuffer, so no two threads share a dirty flag
+	void forEachRow(size_t height, size_t bandHeight, const std::function<void(size_t)> &drawRow);
+
+private:
+	std::vector<std::thread> workers;
+	// Held for a whole job so callers on different threads take turns
+	std::mutex callerMutex;
+	std::mutex jobMutex;
+	std::condition_variable jobStarted;
+	std::condition_variable jobFinished;
+	const std::function<void(size_t)> *job;
+	size_t jobSize;
+	size_t jobGeneration;
+	std::atomic<size_t> nextIndex;
+	size_t activeWorkers;
+	bool stopping;
+
+	void workerLoop();
+	void runJob(const std::function<void(size_t)> &body, size_t count);
+};
+
+// One pool shared by everything that renders, created the first time it is needed
+TileScheduler &getTileScheduler();
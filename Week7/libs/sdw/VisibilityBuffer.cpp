@@ -0,0 +1,73 @@
+#include <cmath>
+#include "Material.h"
+#include "Rasteriser.h"
+#include "TileScheduler.h"
+#include "VisibilityBuffer.h"
+
+void VisibilityBuffer::render(const std::vector<ModelTriangle> &triangles, const CameraEnvironment &cameraEnv, size_t width, size_t height) {
+	if (target.width != width || target.height != height) {
+		target = FrameBuffer(width, height);
+		barycentrics.resize(width * height);
+	}
+	target.clearPixels();
+	target.clearDepth(0.0);
+	Material idMaterial;
+	for (size_t i = 0; i < triangles.size(); i++) {
+		uint32_t id = uint32_t(i + 1);
+		idMaterial.setColour(Colour(int(id >> 16) & 0xFF, int(id >> 8) & 0xFF, int(id & 0xFF)));
+		CanvasTriangle triangle = CanvasTriangle(
+			vertexToImagePlane(triangles[i].vertices[0], cameraEnv, target),
+			vertexToImagePlane(triangles[i].vertices[1], cameraEnv, target),
+			vertexToImagePlane(triangles[i].vertices[2], cameraEnv, target)
+		);
+		drawTextureMapTriangle(target, triangle, idMaterial, nullptr, nullptr);
+	}
+
+	// The plane rather than the triangle itself, so pixels the rasteriser gave to a triangle they only just miss still get a point
+	float rayScaling = 1.0 / getPlaneScaling(target);
+	// Whole bands of rows, as getRow marks the row's dirty tiles
+	getTileScheduler().forEachRow(height, RENDER_TILE_SIZE, [&](size_t y) {
+		uint32_t *row = target.getRow(y);
+		for (size_t x = 0; x < width; x++) {
+			uint32_t id = row[x] & 0xFFFFFF;
+			if (id == 0) continue;
+			const ModelTriangle &triangle = triangles[id - 1];
+			glm::vec3 rayDirection = getPixelRay(x, y, cameraEnv, rayScaling);
+			glm::vec3 edge1 = triangle.vertices[1] - triangle.vertices[0];
+			glm::vec3 edge2 = triangle.vertices[2] - triangle.vertices[0];
+			glm::vec3 p = glm::cross(rayDirection, edge2);
+			float determinant = glm::dot(edge1, p);
+			// Seen edge on, so there's nothing to shade
+			if (std::abs(determinant) < 1e-12f) {
+				row[x] = 0;
+				continue;
+			}
+			glm::vec3 offset = cameraEnv.position - triangle.vertices[0];
+			glm::vec3 q = glm::cross(offset, edge1);
+			barycentrics[y * width + x] = glm::vec2(glm::dot(offset, p), glm::dot(rayDirection, q)) / determinant;
+		}
+	});
+}
+
+bool VisibilityBuffer::getHit(size_t x, size_t y, const std::vector<ModelTriangle> &triangles, const CameraEnvironment &cameraEnv, BVHHit &hit) const {
+	uint32_t id = target.getRow(y)[x] & 0xFFFFFF;
+	if (id == 0) return false;
+	const ModelTriangle &triangle = triangles[id - 1];
+	glm::vec2 barycentric = barycentrics[y * target.width + x];
+	glm::vec3 point = triangle.vertices[0]
+		+ barycentric.x * (triangle.vertices[1] - triangle.vertices[0])
+		+ barycentric.y * (triangle.vertices[2] - triangle.vertices[0]);
+	hit.triangleIndex = id - 1;
+	hit.primitiveIndex = -1;
+	hit.instanceIndex = -1;
+	hit.u = barycentric.x;
+	hit.v = barycentric.y;
+	hit.distance = glm::length(point - cameraEnv.position);
+	return true;
+}
+
+glm::vec3 VisibilityBuffer::getPixelRay(size_t x, size_t y, const CameraEnvironment &cameraEnv, float rayScaling) const {
+	float u = (float(x) - (target.width / 2)) * rayScaling;
+	float v = -1 * (float(y) - (target.height / 2)) * rayScaling;
+	return glm::normalize(cameraEnv.rotation * glm::vec3(u, v, -cameraEnv.focalLength));
+}
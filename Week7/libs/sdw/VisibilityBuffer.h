@@ -0,0 +1,28 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "BVH.h"
+#include "CameraEnvironment.h"
+#include "FrameBuffer.h"
+#include "ModelTriangle.h"
+
+// Which triangle each pixel sees first and where on it, found by rasterising the scene rather than tracing a ray per pixel
+// The rasteriser's depth tested pipeline draws every triangle in a flat colour holding its index + 1, so up to 2^24 - 1
+// triangles, then each pixel's barycentric coordinates are found against just the triangle it ended up with
+class VisibilityBuffer {
+public:
+	// Triangle index + 1 in the colour plane, 0 where nothing was drawn
+	FrameBuffer target;
+	// Where the pixel's centre ray meets its triangle's plane, as barycentric (u, v)
+	std::vector<glm::vec2> barycentrics;
+
+	void render(const std::vector<ModelTriangle> &triangles, const CameraEnvironment &cameraEnv, size_t width, size_t height);
+
+	// The same as tracing the pixel's centre ray, false where it sees nothing
+	bool getHit(size_t x, size_t y, const std::vector<ModelTriangle> &triangles, const CameraEnvironment &cameraEnv, BVHHit &hit) const;
+
+private:
+	// Matches the ray the ray tracer sends through the centre of pixel (x, y)
+	glm::vec3 getPixelRay(size_t x, size_t y, const CameraEnvironment &cameraEnv, float rayScaling) const;
+};
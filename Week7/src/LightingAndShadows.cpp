@@ -4,10 +4,12 @@
 #include <fstream>
 #include <vector>
 #include <map>
+#include <random>
 
 #include <math.h> 
 #include <glm/glm.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
 #include <CanvasPoint.h>
 #include <Colour.h>
@@ -18,76 +20,45 @@
 #include <ModelTriangle.h>
 #include <RayTriangleIntersection.h>
 
-#include <algorithm>
-
-#define WIDTH 700
-#define HEIGHT 700
-
-enum MaterialType { TEXTURE, COLOUR };
-
-class Material {
-	public:
-		MaterialType type;
-		Colour colour;
-		TextureMap textureMap;
-
-		void setColour(Colour newColour){
-			colour = newColour;
-			type = COLOUR;
-		}
-
-		void setTextureMap(TextureMap newTextureMap){
-			textureMap = newTextureMap;
-			type = TEXTURE;
-		}
-};
-
-class CameraEnvironment {
-	public:
-		glm::vec3 position;
-		glm::mat3 rotation;
-		float focalLength;
-
-		void rotateX(float theta) {
-			glm::mat3 rotationX = glm::mat3(
-				1.0, 0.0, 0.0, 					// first column
-				0.0, cos(theta), sin(theta), 	// second column
-				0.0, -sin(theta), cos(theta) 	// third column
-			);
-			rotation = rotation * rotationX;
-		}
-
-		void rotateY(float theta) {
-			glm::mat3 rotationY = glm::mat3(
-				cos(theta), 0.0, -sin(theta), 	// first column
-				0.0, 1.0, 0.0, 					// second column
-				sin(theta), 0.0, cos(theta) 	// third column
-			);
-			rotation = rotation * rotationY;
-		}
+#include <SPSCQueue.h>
+#include <FrameBuffer.h>
+#include <BVH.h>
+#include <Lightmap.h>
+#include <Primitive.h>
+#include <Sampler.h>
+#include <TileScheduler.h>
+#include <CameraEnvironment.h>
+#include <Denoiser.h>
+#include <GBuffer.h>
+#include <Lights.h>
+#include <Material.h>
+#include <PathTracer.h>
+#include <Rasteriser.h>
+#include <RayTracing.h>
+#include <ShadowMaps.h>
+#include <TemporalHistory.h>
+#include <VisibilityBuffer.h>
 
-		void lookAt(glm::vec3 point) {
-			glm::vec3 forward = glm::normalize(position - point);
-			glm::vec3 vertical = glm::vec3(0.0, 1.0, 0.0);
-			glm::vec3 right = glm::normalize(glm::cross(vertical, forward));
-			glm::vec3 up = glm::cross(forward, right);
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
 
-			rotation = glm::mat3(
-				right,
-				up,
-				forward
-			);
-		}
-};
+// Used unless a resolution is given on the command line
+#define DEFAULT_WIDTH 700
+#define DEFAULT_HEIGHT 700
 
-enum RenderingMethod { RASTERISE, RAY_TRACE, WIREFRAME };
+enum RenderingMethod { RASTERISE, RAY_TRACE, WIREFRAME, PATH_TRACE, HYBRID };
 
 float SCALING_FACTOR = 0.17;
 
-float PLANE_SCALING = 700.0;
-
-float SHADOW_FADE = 0.5;
-float BRIGHTNESS_SCALING = 1.0 / (M_PI);
+// Used by ray traced, hybrid and deferred rasterised frames (H cycles through them)
+ShadingModel SHADING_MODEL = FLAT_SHADING;
 
 // MTL Parser
 
@@ -120,19 +91,33 @@ std::map<std::string, Material> loadMaterialsFromMTL(std::string filename) {
 				colourComponents[2]
 			);
 			
-			Material colourMaterial;
-			
-			colourMaterial.setColour(colour);
-			materialMap[name] = colourMaterial;
+			// Set on the material in place, so the other properties can come before or after
+			materialMap[name].setColour(colour);
 		}
 
 		if (substrs[0] == "map_Kd"){
 			TextureMap textureMap = TextureMap(substrs[1]);
-			
-			Material textureMaterial;
-			textureMaterial.setTextureMap(textureMap);
-			
-			materialMap[name] = textureMaterial;
+			materialMap[name].setTextureMap(textureMap);
+		}
+
+		if (substrs[0] == "Ks"){
+			materialMap[name].specularColour = glm::vec3(std::stof(substrs[1]), std::stof(substrs[2]), std::stof(substrs[3]));
+		}
+
+		if (substrs[0] == "Ns"){
+			materialMap[name].specularExponent = std::stof(substrs[1]);
+		}
+
+		if (substrs[0] == "Ni"){
+			materialMap[name].refractiveIndex = std::stof(substrs[1]);
+		}
+
+		if (substrs[0] == "d"){
+			materialMap[name].dissolve = std::stof(substrs[1]);
+		}
+
+		if (substrs[0] == "illum"){
+			materialMap[name].illumination = std::stoi(substrs[1]);
 		}
 	}
 
@@ -150,6 +135,39 @@ int objIndexToVertexIndex(std::string objIndex) {
 	return std::stoi(objIndex) - 1;
 }
 
+// Triangles meeting at more than this many degrees keep a hard edge between them when vertex normals are generated
+float SMOOTHING_ANGLE = 60.0;
+
+// Vertex normals for the triangles the file gave none, averaged from the triangles sharing each vertex weighted by area
+// Triangles at more than SMOOTHING_ANGLE to the one being smoothed are left out, so the corners of boxes stay sharp
+void generateVertexNormals(
+		std::vector<ModelTriangle> &triangles,
+		const std::vector<std::array<int, 3>> &vertexIndices,
+		const std::vector<bool> &hasNormals,
+		size_t vertexCount
+	) {
+	std::vector<std::vector<size_t>> vertexTriangles(vertexCount);
+	for (size_t i = 0; i < triangles.size(); i++) {
+		for (int j = 0; j < 3; j++) vertexTriangles[vertexIndices[i][j]].push_back(i);
+	}
+
+	float minCosine = cos(SMOOTHING_ANGLE * M_PI / 180.0);
+	for (size_t i = 0; i < triangles.size(); i++) {
+		if (hasNormals[i]) continue;
+		for (int j = 0; j < 3; j++) {
+			// Cross products are twice the triangle's area long, so summing them weights each triangle by its area
+			glm::vec3 sum = glm::vec3(0.0);
+			for (size_t other : vertexTriangles[vertexIndices[i][j]]) {
+				const ModelTriangle &triangle = triangles[other];
+				if (glm::dot(triangle.normal, triangles[i].normal) < minCosine) continue;
+				sum += glm::cross(triangle.vertices[1] - triangle.vertices[0], triangle.vertices[2] - triangle.vertices[0]);
+			}
+			float length = glm::length(sum);
+			triangles[i].vertexNormals[j] = (length > 0.0f) ? sum / length : triangles[i].normal;
+		}
+	}
+}
+
 std::vector<ModelTriangle> loadFromOBJ(
 		std::string filename,
 		std::map<std::string, Material> materialMap,
@@ -160,6 +178,10 @@ std::vector<ModelTriangle> loadFromOBJ(
 	std::string line;
 	std::vector<glm::vec3> verticies;
 	std::vector<TexturePoint> texturePoints;
+	std::vector<glm::vec3> normals;
+	// OBJ vertex index of each corner of each triangle, and whether the file gave it normals
+	std::vector<std::array<int, 3>> vertexIndices;
+	std::vector<bool> hasNormals;
 	bool materialSet;
 	Material material;
 	while(std::getline(fileStream, line)){
@@ -188,9 +210,16 @@ std::vector<ModelTriangle> loadFromOBJ(
 			texturePoints.push_back(texturePoint);
 		}
 
+		if (substrs[0] == "vn") {
+			glm::vec3 normal = glm::vec3(std::stof(substrs[1]), std::stof(substrs[2]), std::stof(substrs[3]));
+			normals.push_back(glm::normalize(normal));
+		}
+
 		if (substrs[0] == "f") {
 			ModelTriangle triangle = ModelTriangle();
 			std::vector<std::string> lineComponents = split(line, ' ');
+			std::array<int, 3> faceVertexIndices;
+			bool faceHasNormals = true;
 
 			for (size_t i = 1; i < lineComponents.size(); i++){
 				size_t index = i - 1;
@@ -199,6 +228,12 @@ std::vector<ModelTriangle> loadFromOBJ(
 				std::vector<std::string> vertexIndexes = split(lineComponents[i], '/');
 				int modelVertexIndex = objIndexToVertexIndex(vertexIndexes[0]);
 				triangle.vertices[index] = verticies[modelVertexIndex];
+				faceVertexIndices[index] = modelVertexIndex;
+
+				// USING VERTEX NORMALS
+				if (vertexIndexes.size() > 2 && vertexIndexes[2] != "") {
+					triangle.vertexNormals[index] = normals[objIndexToVertexIndex(vertexIndexes[2])];
+				} else faceHasNormals = false;
 
 				// USING COLOUR
 				if (vertexIndexes[1] == ""){
@@ -219,19 +254,18 @@ std::vector<ModelTriangle> loadFromOBJ(
 			glm::vec3 edge2 = triangle.vertices[2] - triangle.vertices[0];
 			triangle.normal = glm::normalize(glm::cross(edge1, edge2));
 			modelTriangles.push_back(triangle);
+			vertexIndices.push_back(faceVertexIndices);
+			hasNormals.push_back(faceHasNormals);
 		}
 	}
 
 	fileStream.close();
+	generateVertexNormals(modelTriangles, vertexIndices, hasNormals, verticies.size());
 	return modelTriangles;
 }
 
 // UTILS
 
-uint32_t colourToCode(Colour colour){
-	return (colour.red << 16) + (colour.green << 8) + colour.blue;
-}
-
 std::vector<CanvasPoint> getLinePoints(CanvasPoint from, CanvasPoint to) {
 	std::vector<CanvasPoint> points;
 
@@ -268,260 +302,8 @@ void CHECK(bool assertion, std::string failureMessage, size_t lineNumber) {
 	}
 }
 
-float interpolatePointDepth(CanvasPoint from, CanvasPoint to, CanvasPoint pointOnLine) {
-	assert(from.depth >= 0);
-	assert(to.depth >= 0);
-
-	float depthDiff = to.depth - from.depth;
-	float percentage = (pointOnLine.x - from.x) / (to.x - from.x);
-
-	// Resolves issues where dividing by a number close to 0 make percentage NaN
-	if (!isnormal(percentage)) {
-		assert(isnormal(from.depth));
-		return from.depth;
-	}
-	
-	float interpolatedDepth = from.depth + (percentage * depthDiff);
-	assert(interpolatedDepth >= 0);
-
-	return interpolatedDepth;
-}
-
-bool validCoord(int x, int y) {
-	return 0 <= x && x < WIDTH && 0 <= y && y < HEIGHT;
-}
-
-void sortVerticies(std::array<CanvasPoint, 3UL> &verticies){
-	if (verticies[0].y > verticies[1].y){
-		std::swap(verticies[0], verticies[1]);
-	}
-	if (verticies[0].y > verticies[2].y){
-		std::swap(verticies[0], verticies[2]);
-	}
-	if (verticies[1].y > verticies[2].y){
-		std::swap(verticies[1], verticies[2]);
-	}
-}
-
-CanvasPoint getIntersectionPoint(std::array<CanvasPoint, 3UL> &verticies){
-
-	assert(verticies[0].y <= verticies[1].y);
-	assert(verticies[1].y <= verticies[2].y);
-
-	float yPercentage = (verticies[1].y - verticies[0].y) / (verticies[2].y - verticies[0].y);
-	float xDiffVector = verticies[2].x - verticies[0].x;
-	float x = verticies[0].x + (yPercentage * xDiffVector);
-	return CanvasPoint(x, verticies[1].y);
-}
-
-
-// TEXTURE FUNCTIONS
-
-uint32_t getTexturePixelColour(TextureMap textureMap, float x, float y){
-	uint32_t index = round(y) * textureMap.width + round(x);
-	return textureMap.pixels[index];
-} 
-
-TexturePoint interpolateIntoTextureMap(CanvasPoint from, CanvasPoint to, CanvasPoint pointOnLine) {
-	float xPercentage = (pointOnLine.x - from.x) / (to.x - from.x);
-	float yPercentage = (pointOnLine.x - from.x) / (to.x - from.x);
-	
-	// asserts pointOnLine is on the line between from and to
-	// Too sensitive to minute rounding errors?
-	// assert(xPercentage == yPercentage);
-
-	float texturePointXDiff = to.texturePoint.x - from.texturePoint.x;
-	float texturePointYDiff = to.texturePoint.y - from.texturePoint.y;
-	float interpolatedPointX = from.texturePoint.x + (xPercentage * texturePointXDiff);
-	float interpolatedPointY = from.texturePoint.y + (yPercentage * texturePointYDiff);
-
-	return TexturePoint(interpolatedPointX, interpolatedPointY);
-}
-
-// RASTERISING FUNCTIONS
-
-void drawTextureLine(
-		DrawingWindow &window, 
-		CanvasPoint from, 
-		CanvasPoint to, 
-		Material material,
-		float depthBuffer[WIDTH][HEIGHT]
-	){
-	std::vector<CanvasPoint> points = getLinePoints(from, to);
-	for(size_t i = 0; i < points.size(); i++) {
-		int x = round(points[i].x);
-		int y = round(points[i].y);
-		
-		float depth = interpolatePointDepth(from, to, points[i]);
-
-		uint32_t colourCode;
-		if (material.type == TEXTURE) {
-			TexturePoint texturePoint = interpolateIntoTextureMap(from, to, points[i]);
-			colourCode = getTexturePixelColour(material.textureMap, texturePoint.x, texturePoint.y);
-		}
-		else if (material.type == COLOUR) {
-			colourCode = colourToCode(material.colour);
-		}
-
-		if (validCoord(x, y)) {
-			if (depthBuffer[x][y] < depth){
-				window.setPixelColour(x, y, colourCode);
-				depthBuffer[x][y] = depth;
-			}
-		};
-	}
-}
-
-void drawTopTextureTriangle(
-		DrawingWindow &window, 
-		CanvasPoint top, 
-		CanvasPoint bottomLeftPoint, 
-		CanvasPoint bottomRightPoint,
-		Material material,
-		float depthBuffer[WIDTH][HEIGHT]
-	){
-
-	assert(top.y <= bottomLeftPoint.y);
-	assert(top.y <= bottomRightPoint.y);
-	assert(bottomLeftPoint.x <= bottomRightPoint.x);
-	assert(bottomLeftPoint.y == bottomRightPoint.y);
-
-	float verticalSteps = bottomLeftPoint.y - top.y;
-
-	float leftStepDelta = (bottomLeftPoint.x - top.x) / verticalSteps;
-	float rightStepDelta = (bottomRightPoint.x - top.x) / verticalSteps;
-
-	float currentLeftX = top.x;
-	float currentRightX = top.x;
-
-	for (float y = top.y; y <= bottomLeftPoint.y; y++) {
-		CanvasPoint leftPoint = CanvasPoint(currentLeftX, y);
-		leftPoint.depth = interpolatePointDepth(top, bottomLeftPoint, leftPoint);
-
-		CanvasPoint rightPoint = CanvasPoint(currentRightX, y);
-		rightPoint.depth = interpolatePointDepth(top, bottomRightPoint, rightPoint);
-
-		if (material.type == TEXTURE){
-			leftPoint.texturePoint = interpolateIntoTextureMap(top, bottomLeftPoint, leftPoint);
-			rightPoint.texturePoint = interpolateIntoTextureMap(top, bottomRightPoint, rightPoint);
-		}
-
-		drawTextureLine(window, leftPoint, rightPoint, material, depthBuffer);
-
-		currentLeftX += leftStepDelta;
-		currentRightX += rightStepDelta;
-	}
-}
-
-void drawBottomTextureTriangle(
-		DrawingWindow &window, 
-		CanvasPoint bottom, 
-		CanvasPoint topLeftPoint, 
-		CanvasPoint topRightPoint,
-		Material material,
-		float depthBuffer[WIDTH][HEIGHT]
-	){
-
-	assert(topLeftPoint.y <= bottom.y);
-	assert(topRightPoint.y <= bottom.y);
-	assert(topLeftPoint.x <= topRightPoint.x);
-	assert(topLeftPoint.y == topRightPoint.y);
-
-	float verticalSteps = bottom.y - topLeftPoint.y;
-
-	float leftStepDelta = (bottom.x - topLeftPoint.x) / verticalSteps;
-	float rightStepDelta = (bottom.x - topRightPoint.x) / verticalSteps;
-
-	float currentLeftX = topLeftPoint.x;
-	float currentRightX = topRightPoint.x;
-
-	for (float y = topLeftPoint.y; y <= bottom.y; y++) {
-		CanvasPoint leftPoint = CanvasPoint(currentLeftX, y);
-		leftPoint.depth = interpolatePointDepth(topLeftPoint, bottom, leftPoint);
-
-		CanvasPoint rightPoint = CanvasPoint(currentRightX, y);
-		rightPoint.depth = interpolatePointDepth(topRightPoint, bottom, rightPoint);
-
-		if (material.type == TEXTURE) {
-			leftPoint.texturePoint = interpolateIntoTextureMap(topLeftPoint, bottom, leftPoint);
-			rightPoint.texturePoint = interpolateIntoTextureMap(topRightPoint, bottom, rightPoint);
-		}
-
-		drawTextureLine(window, leftPoint, rightPoint, material, depthBuffer);
-		currentLeftX += leftStepDelta;
-		currentRightX += rightStepDelta;
-	}
-}
-
-void drawTextureMapTriangle(
-		DrawingWindow &window, 
-		CanvasTriangle triangle, 
-		Material material,
-		float depthBuffer[WIDTH][HEIGHT]
-	){
-
-	sortVerticies(triangle.vertices);
-	CanvasPoint top = triangle.vertices[0];
-	CanvasPoint middle = triangle.vertices[1];
-	CanvasPoint bottom = triangle.vertices[2];
-
-	CanvasPoint intersectionPoint = getIntersectionPoint(triangle.vertices);
-	intersectionPoint.depth = interpolatePointDepth(top, bottom, intersectionPoint);
-
-	if (material.type == TEXTURE) {
-		intersectionPoint.texturePoint = interpolateIntoTextureMap(top, bottom, intersectionPoint);
-	}
-
-	CanvasPoint leftPoint = middle;
-	CanvasPoint rightPoint = intersectionPoint;
-	if (rightPoint.x < leftPoint.x){
-		std::swap(leftPoint, rightPoint);
-	}
-
-	drawTopTextureTriangle(window, top, leftPoint, rightPoint, material, depthBuffer);
-	drawBottomTextureTriangle(window, bottom, leftPoint, rightPoint, material, depthBuffer);
-}
-
-CanvasPoint vertexToImagePlane(glm::vec3 vertex, CameraEnvironment cameraEnv) {
-	glm::vec3 absoluteDist = cameraEnv.position - vertex;
-	absoluteDist.z *= -1;
-	glm::vec3 orientedDist = cameraEnv.rotation * absoluteDist;
-
-	// Checks that vertex in front of image plane
-	// assert(abs(orientedDist.z) > cameraEnv.focalLength);
-
-	float u = (cameraEnv.focalLength / orientedDist.z) * orientedDist.x * PLANE_SCALING + WIDTH / 2;
-	
-	// negative since y of zero at top of page
-	float v = -((cameraEnv.focalLength / orientedDist.z) * orientedDist.y * PLANE_SCALING) + HEIGHT / 2;
-
-	float depth = 1 / (abs(orientedDist.z));
-	
-	return CanvasPoint(u, v, depth);
-}
-
-void drawRasterisedModel(
-		DrawingWindow &window,
-		std::vector<ModelTriangle> triangles,
-		std::vector<Material> materials,
-		float depthBuffer[WIDTH][HEIGHT],
-		CameraEnvironment &cameraEnv
-	) {
-	for (int i = 0; i < triangles.size(); i++){
-		std::vector<CanvasPoint> verticies;
-		for (int j = 0; j < 3; j++){
-			glm::vec3 modelVertex = triangles[i].vertices[j];
-			CanvasPoint point = vertexToImagePlane(modelVertex, cameraEnv);
-
-			if (materials[i].type == TEXTURE){
-				point.texturePoint = triangles[i].texturePoints[j];
-			}
-
-			verticies.push_back(point);
-		}
-		CanvasTriangle triangle = CanvasTriangle(verticies[0], verticies[1], verticies[2]);
-		drawTextureMapTriangle(window, triangle, materials[i], depthBuffer);
-	}
+bool validCoord(int x, int y, const FrameBuffer &frameBuffer) {
+	return 0 <= x && x < int(frameBuffer.width) && 0 <= y && y < int(frameBuffer.height);
 }
 
 // Transformation
@@ -545,238 +327,843 @@ glm::vec3 rotateY(glm::vec3 vector, float theta){
 	return rotation * vector;
 }
 
+// Lit by lightmap if there is one, otherwise drawn in flat colour
 void rasterise(
-		DrawingWindow &window,
+		FrameBuffer &frameBuffer,
 		std::vector<ModelTriangle> triangles,
 		std::vector<Material> materials,
-		float depthBuffer[WIDTH][HEIGHT],
-		CameraEnvironment &cameraEnv
+		CameraEnvironment &cameraEnv,
+		const Lightmap *lightmap
 	) {
-	window.clearPixels();
-
-	for (int i = 0; i < WIDTH; i++) {
-		for (int j = 0; j < HEIGHT; j++) {
-			depthBuffer[i][j] = 0.0;
-		}
-	}
+	frameBuffer.clearPixels();
+	frameBuffer.clearDepth(0.0);
 
 	drawRasterisedModel(
-		window,
+		frameBuffer,
 		triangles,
 		materials,
-		depthBuffer,
-		cameraEnv
+		cameraEnv,
+		lightmap,
+		nullptr
 	);
 }
 
 // WIRE-FRAMING
 
-void drawColourLine(DrawingWindow &window, CanvasPoint from, CanvasPoint to, Colour colour) {
+void drawColourLine(FrameBuffer &frameBuffer, CanvasPoint from, CanvasPoint to, Colour colour) {
 	std::vector<CanvasPoint> points = getLinePoints(from, to);
 	int colourCode = colourToCode(colour);
 	for(size_t i = 0; i < points.size(); i++) {
 		int x = round(points[i].x);
 		int y = round(points[i].y);
 		
-		if (validCoord(x, y)) {
-			window.setPixelColour(x, y, colourCode);
+		if (validCoord(x, y, frameBuffer)) {
+			frameBuffer.setPixelColour(x, y, colourCode);
 		};
 	}
 }
 
-void drawStrokedTriangle(DrawingWindow &window, CanvasTriangle triangle, Material material){
+void drawStrokedTriangle(FrameBuffer &frameBuffer, CanvasTriangle triangle, Material material){
 	if (material.type == TEXTURE){
 		material.colour = Colour(255,255,255);
 	}
-	drawColourLine(window, triangle.vertices[0], triangle.vertices[1], material.colour);
-	drawColourLine(window, triangle.vertices[1], triangle.vertices[2], material.colour);
-	drawColourLine(window, triangle.vertices[2], triangle.vertices[0], material.colour);
+	drawColourLine(frameBuffer, triangle.vertices[0], triangle.vertices[1], material.colour);
+	drawColourLine(frameBuffer, triangle.vertices[1], triangle.vertices[2], material.colour);
+	drawColourLine(frameBuffer, triangle.vertices[2], triangle.vertices[0], material.colour);
 }
 
 void drawWireframeModel(
-		DrawingWindow &window,
+		FrameBuffer &frameBuffer,
 		std::vector<ModelTriangle> triangles,
 		std::vector<Material> materials,
 		CameraEnvironment &cameraEnv
 	) {
-	window.clearPixels();
+	frameBuffer.clearPixels();
 	for (int i = 0; i < triangles.size(); i++){
 		std::vector<CanvasPoint> verticies;
 		for (int j = 0; j < 3; j++){
 			glm::vec3 modelVertex = triangles[i].vertices[j];
-			CanvasPoint point = vertexToImagePlane(modelVertex, cameraEnv);
+			CanvasPoint point = vertexToImagePlane(modelVertex, cameraEnv, frameBuffer);
 			verticies.push_back(point);
 		}
 		CanvasTriangle triangle = CanvasTriangle(verticies[0], verticies[1], verticies[2]);
-		drawStrokedTriangle(window, triangle, materials[i]);
+		drawStrokedTriangle(frameBuffer, triangle, materials[i]);
 	}
 }
 
-// RAY TRACING
+// LIGHTS
+
+int MAX_LIGHT_SAMPLES = 256;
+
+// Planes have no bounds so they are left out
+void getSceneBounds(
+		const std::vector<ModelTriangle> &triangles,
+		const std::vector<Primitive> &primitives,
+		const std::vector<BVHInstance> &instances,
+		glm::vec3 &boundsMin,
+		glm::vec3 &boundsMax) {
+	boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (size_t i = 0; i < triangles.size(); i++) {
+		for (int j = 0; j < 3; j++) {
+			boundsMin = glm::min(boundsMin, triangles[i].vertices[j]);
+			boundsMax = glm::max(boundsMax, triangles[i].vertices[j]);
+		}
+	}
+	for (size_t i = 0; i < primitives.size(); i++) {
+		if (!primitives[i].isBounded()) continue;
+		glm::vec3 primitiveMin;
+		glm::vec3 primitiveMax;
+		primitives[i].getBounds(primitiveMin, primitiveMax);
+		boundsMin = glm::min(boundsMin, primitiveMin);
+		boundsMax = glm::max(boundsMax, primitiveMax);
+	}
+	for (size_t i = 0; i < instances.size(); i++) {
+		glm::vec3 instanceMin;
+		glm::vec3 instanceMax;
+		instances[i].getBounds(instanceMin, instanceMax);
+		boundsMin = glm::min(boundsMin, instanceMin);
+		boundsMax = glm::max(boundsMax, instanceMax);
+	}
+}
+
+// Which sequence the ray and path tracers draw their sample points from (B cycles through them)
+SamplerType SAMPLER_TYPE = SOBOL_SAMPLER;
 
-bool isValidSolution(glm::vec3 solution) {
-	float t = solution.x;
-	float u = solution.y;
-	float v = solution.z;
+// RAY TRACING
 
-	return (u >= 0.0) && (u <= 1.0) && (v >= 0.0) && (v <= 1.0) && (u + v) <= 1.0 && t >= 0;
+// Collapses BVHs into ones with BVH_WIDTH children per node, which trace faster and take less memory
+bool WIDE_BVH = true;
+
+// Builds the scene's BVH, reporting how long that took and how good a tree it is
+BVH buildBVH(const std::vector<ModelTriangle> &triangles, const std::vector<Primitive> &primitives, const std::vector<BVHInstance> &instances) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	BVH bvh(triangles, primitives, instances);
+	if (WIDE_BVH) bvh.makeWide();
+	std::chrono::duration<float, std::milli> buildTime = std::chrono::steady_clock::now() - start;
+	std::cout << "BVH: " << bvh.nodeCount() << (bvh.isWide() ? " wide" : "") << " nodes in " << bvh.getNodeMemory() / 1024 << " KB, SAH cost "
+		<< bvh.getCost() << ", built in " << buildTime.count() << " ms" << std::endl;
+	return bvh;
 }
 
-bool intersectionComparator(RayTriangleIntersection a, RayTriangleIntersection b) {
-	return a.distanceFromCamera < b.distanceFromCamera;
+// Vertex normals interpolated to barycentric (u, v) on the triangle
+glm::vec3 getSmoothNormal(const ModelTriangle &triangle, float u, float v) {
+	return glm::normalize((1.0f - u - v) * triangle.vertexNormals[0] + u * triangle.vertexNormals[1] + v * triangle.vertexNormals[2]);
 }
 
-RayTriangleIntersection getClosestIntersection(std::vector<RayTriangleIntersection> intersections) {
-	assert(!intersections.empty());
-	return *std::min_element(
-		intersections.begin(),
-		intersections.end(),
-		intersectionComparator
-	);
-} 
-
-std::vector<RayTriangleIntersection> getIntersections(
-		glm::vec3 cameraPosition, 
-		glm::vec3 rayDirection, 
-		std::vector<ModelTriangle> triangles){
-	
-	std::vector<RayTriangleIntersection> intersections;
-	glm::vec3 normalisedRayDirection = glm::normalize(rayDirection);
-
-	for (size_t i = 0; i < triangles.size(); i++){
-		ModelTriangle triangle = triangles[i];
-		glm::vec3 e0 = triangle.vertices[1] - triangle.vertices[0];
-		glm::vec3 e1 = triangle.vertices[2] - triangle.vertices[0];
-		glm::vec3 SPVector = cameraPosition - triangle.vertices[0];
-		glm::mat3 DEMatrix(-normalisedRayDirection, e0, e1);
-		glm::vec3 possibleSolution = glm::inverse(DEMatrix) * SPVector;
-
-		if (isValidSolution(possibleSolution)) {
-			glm::vec3 intersectionPoint = cameraPosition + possibleSolution[0] * normalisedRayDirection;
-			RayTriangleIntersection rayTriangleIntersection = RayTriangleIntersection(
-				intersectionPoint,
-				possibleSolution[0],
-				triangle,
-				i
-			);
-			intersections.push_back(rayTriangleIntersection);
-		};
+// Point at barycentric (u, v) moved out onto the curved surface the vertex normals describe (Hanika's shadow terminator fix)
+// Shadow rays leaving from there aren't blocked by the flat neighbouring triangles where smooth shading says the point is lit
+// Left where it was if that would take it to the side the camera doesn't see
+glm::vec3 getSmoothShadowPoint(const ModelTriangle &triangle, float u, float v, glm::vec3 point, glm::vec3 facingNormal) {
+	float weights[3] = {1.0f - u - v, u, v};
+	glm::vec3 offset = glm::vec3(0.0);
+	for (int i = 0; i < 3; i++) {
+		// How far below the tangent plane at the vertex the point lies, nothing if it's above it
+		float depthBelow = std::min(glm::dot(point - triangle.vertices[i], triangle.vertexNormals[i]), 0.0f);
+		offset -= weights[i] * depthBelow * triangle.vertexNormals[i];
 	}
-
-	return intersections;
+	return (glm::dot(offset, facingNormal) > 0.0f) ? point + offset : point;
 }
 
-Colour adjustBrightness(Colour colour, float brightness) {
+// BATCHED SHADING
 
-	return Colour(
-		float(colour.red) * brightness,
-		float(colour.green) * brightness, 
-		float(colour.blue) * brightness
-	);
+#define SHADING_BATCH_SIZE 256
+
+// Light samples waiting to be shaded, stored as a structure of arrays so the shading loop vectorises
+// Each entry is one sample of one light as seen from one pixel of the span being traced
+class ShadingBatch {
+	public:
+		int size = 0;
+		// Inputs: ray from the shaded point to the light sample, the surface normal and the light's falloff
+		alignas(CACHE_LINE_SIZE) float lightX[SHADING_BATCH_SIZE];
+		alignas(CACHE_LINE_SIZE) float lightY[SHADING_BATCH_SIZE];
+		alignas(CACHE_LINE_SIZE) float lightZ[SHADING_BATCH_SIZE];
+		alignas(CACHE_LINE_SIZE) float normalX[SHADING_BATCH_SIZE];
+		alignas(CACHE_LINE_SIZE) float normalY[SHADING_BATCH_SIZE];
+		alignas(CACHE_LINE_SIZE) float normalZ[SHADING_BATCH_SIZE];
+		alignas(CACHE_LINE_SIZE) float intensity[SHADING_BATCH_SIZE];
+		alignas(CACHE_LINE_SIZE) float inverseInfluenceRadius[SHADING_BATCH_SIZE];
+		// Outputs of shade()
+		alignas(CACHE_LINE_SIZE) float distance[SHADING_BATCH_SIZE];
+		alignas(CACHE_LINE_SIZE) float diffuse[SHADING_BATCH_SIZE];
+		alignas(CACHE_LINE_SIZE) float specular[SHADING_BATCH_SIZE];
+		// Which pixel of the span the sample lights, and its share of that light's total
+		int pixel[SHADING_BATCH_SIZE];
+		float weight[SHADING_BATCH_SIZE];
+
+		bool full() const {
+			return size == SHADING_BATCH_SIZE;
+		}
+
+		void add(glm::vec3 lightRay, glm::vec3 normal, const AreaLight &light, int pixelIndex, float sampleWeight) {
+			lightX[size] = lightRay.x;
+			lightY[size] = lightRay.y;
+			lightZ[size] = lightRay.z;
+			normalX[size] = normal.x;
+			normalY[size] = normal.y;
+			normalZ[size] = normal.z;
+			intensity[size] = light.intensity;
+			inverseInfluenceRadius[size] = 1.0f / light.influenceRadius;
+			pixel[size] = pixelIndex;
+			weight[size] = sampleWeight;
+			size++;
+		}
+
+		// Diffuse, specular and falloff for every entry, the same sums as getLightBrightness but branch free
+		void shade(float specularWeight) {
+			// Copied so the compiler knows the stores below can't change it
+			int count = size;
+			for (int i = 0; i < count; i++) {
+				float distanceSquared = lightX[i] * lightX[i] + lightY[i] * lightY[i] + lightZ[i] * lightZ[i];
+				float sampleDistance = sqrtf(distanceSquared);
+				float cosine = (lightX[i] * normalX[i] + lightY[i] * normalY[i] + lightZ[i] * normalZ[i]) / sampleDistance;
+				float ratio = sampleDistance * inverseInfluenceRadius[i];
+				float ratioSquared = ratio * ratio;
+				float window = std::max(1.0f - ratioSquared * ratioSquared, 0.0f);
+				float influence = intensity[i] * window * window;
+				distance[i] = sampleDistance;
+				diffuse[i] = BRIGHTNESS_SCALING / distanceSquared * std::max(cosine, 0.0f) * influence;
+				specular[i] = specularWeight * influence * pow256(cosine);
+			}
+		}
+
+		// Traces a shadow ray for each shaded entry that matters and adds its light to brightness[pixel], then empties the batch
+		void resolve(const BVH &bvh, const glm::vec3 *shadowOrigins, float *brightness) {
+			for (int i = 0; i < size; i++) {
+				if (diffuse[i] <= 0.0f && specular[i] < 0.001f) continue;
+				glm::vec3 direction = glm::vec3(lightX[i], lightY[i], lightZ[i]) / distance[i];
+				if (bvh.occluded(shadowOrigins[pixel[i]], direction, distance[i] - SHADOW_BIAS)) {
+					brightness[pixel[i]] += weight[i] * diffuse[i] * SHADOW_FADE;
+				} else {
+					brightness[pixel[i]] += weight[i] * (diffuse[i] + specular[i]);
+				}
+			}
+			size = 0;
+		}
+};
+
+// DENOISING
+
+// Press V to turn denoising of ray and path traced frames on and off
+bool DENOISE = true;
+
+// TEMPORAL REPROJECTION
+
+// Press T to turn reuse of earlier frames' samples on and off for ray and path traced frames
+bool TEMPORAL_REPROJECTION = true;
+// A still view stops being refined by the ray tracer once it has averaged this many frames
+int TEMPORAL_MAX_HISTORY = 64;
+
+// Scales each pixel's colour by its brightness, plus MIN_BRIGHTNESS, and packs it for the frame buffer
+void packColours(int count, const float *brightness, const float *red, const float *green, const float *blue, uint32_t *colours) {
+	for (int i = 0; i < count; i++) {
+		float scale = std::min(brightness[i] + MIN_BRIGHTNESS, 1.0f);
+		colours[i] = (uint32_t(red[i] * scale) << 16) | (uint32_t(green[i] * scale) << 8) | uint32_t(blue[i] * scale);
+	}
 }
 
-float getSpecularCoefficient(glm::vec3 normal, glm::vec3 incidenceDirection, glm::vec3 viewDirection){
-	glm::vec3 reflectionDirection = incidenceDirection - 2.0f * normal * glm::dot(normal, incidenceDirection);
-	float specularCoefficent = glm::dot(reflectionDirection, normal);
-	return pow(specularCoefficent, 256);
+// Light at each corner of each triangle for Gouraud shading, taking the same light samples as this frame's pixels
+// Every vertex uses the same sample points, so triangles sharing a vertex agree on its light
+std::vector<std::array<float, 3>> getVertexBrightnesses(
+		const std::vector<ModelTriangle> &triangles,
+		const BVH &bvh,
+		const CameraEnvironment &cameraEnv,
+		const LightGrid &lightGrid,
+		uint32_t firstSample) {
+	std::vector<std::array<float, 3>> brightnesses(triangles.size());
+	Sampler sampler(SAMPLER_TYPE, 0, 0);
+	getTileScheduler().parallelFor(triangles.size(), [&](size_t i) {
+		for (int j = 0; j < 3; j++) {
+			glm::vec3 vertex = triangles[i].vertices[j];
+			glm::vec3 rayDirection = glm::normalize(vertex - cameraEnv.position);
+			brightnesses[i][j] = getSceneBrightness(bvh, lightGrid, vertex, triangles[i].vertexNormals[j], rayDirection, sampler, firstSample, 0, 0.3f);
+		}
+	});
+	return brightnesses;
 }
 
 void rayTraceModel(
-		DrawingWindow &window,
-		std::vector<ModelTriangle> triangles,
-		std::vector<Material> materials,
-		CameraEnvironment &cameraEnv,
-		glm::vec3 light){
-	float RAY_SCALING = 1.0 / PLANE_SCALING;
-	for (int x = 0; x < WIDTH; x++){
-		for (int y = 0; y < HEIGHT; y++){
-			float u = (float(x) - (WIDTH / 2)) * RAY_SCALING;
-			float v = -1 * (float(y) - (WIDTH / 2)) * RAY_SCALING;
-
-			glm::vec3 imagePlanePoint = glm::vec3(u, v, -cameraEnv.focalLength) + cameraEnv.position;
-			glm::vec3 rayDirection = imagePlanePoint - cameraEnv.position;
-			glm::vec3 rotatedRayDirection = cameraEnv.rotation * rayDirection;
-
-			std::vector<RayTriangleIntersection> intersections = getIntersections(cameraEnv.position, rotatedRayDirection, triangles);
-			if (!intersections.empty()){
-				RayTriangleIntersection intersection = getClosestIntersection(intersections);
-				glm::vec3 lightRay = light - intersection.intersectionPoint;
-				float distanceToLight = glm::length(lightRay);
-
-				std::vector<RayTriangleIntersection> shadowIntersections = getIntersections(
-					intersection.intersectionPoint,
-					lightRay,
-					triangles
-				); 
-				
+		FrameBuffer &frameBuffer,
+		const std::vector<ModelTriangle> &triangles,
+		const std::vector<Material> &materials,
+		const BVH &bvh,
+		const CameraEnvironment &cameraEnv,
+		const LightGrid &lightGrid,
+		Denoiser *denoiser,
+		TemporalHistory *history,
+		const VisibilityBuffer *visibility){
+	float RAY_SCALING = 1.0 / getPlaneScaling(frameBuffer);
+	int width = frameBuffer.width;
+	int height = frameBuffer.height;
+	if (denoiser) denoiser->resize(width, height);
+	// With a history each frame takes the next set of light samples and averages them into what came before
+	bool moved = history && history->beginFrame(width, height, cameraEnv, RAY_SCALING, TEMPORAL_REPROJECTION);
+	uint32_t firstSample = history ? history->frame : 0;
+	ShadingModel shadingModel = SHADING_MODEL;
+	std::vector<std::array<float, 3>> vertexBrightnesses;
+	if (shadingModel == GOURAUD_SHADING) vertexBrightnesses = getVertexBrightnesses(triangles, bvh, cameraEnv, lightGrid, firstSample);
+	// Tiles are shaded in parallel a row at a time
+	// Every light sample the row needs is queued in a batch and shaded together, then the row is packed and stored with a single write
+	// With a denoiser, rows go to it instead and are packed once the whole frame has been filtered
+	getTileScheduler().forEachTile(width, height, RENDER_TILE_SIZE, [&](const Tile &tile) {
+		int spanWidth = tile.toX - tile.fromX;
+		std::vector<uint32_t> row(spanWidth);
+		std::vector<float> brightness(spanWidth);
+		std::vector<float> red(spanWidth);
+		std::vector<float> green(spanWidth);
+		std::vector<float> blue(spanWidth);
+		std::vector<glm::vec3> shadowOrigins(spanWidth);
+		// What mirror and glass surfaces send back, and the share of the pixel left for the surface's own colour
+		std::vector<glm::vec3> specularColours(spanWidth);
+		std::vector<float> diffuseShares(spanWidth);
+		ShadingBatch batch;
+		for (int y = tile.fromY; y < tile.toY; y++){
+			std::fill(brightness.begin(), brightness.end(), 0.0f);
+			std::fill(diffuseShares.begin(), diffuseShares.end(), 1.0f);
+			std::fill(red.begin(), red.end(), 0.0f);
+			std::fill(green.begin(), green.end(), 0.0f);
+			std::fill(blue.begin(), blue.end(), 0.0f);
+			for (int x = tile.fromX; x < tile.toX; x++){
+				float u = (float(x) - (width / 2)) * RAY_SCALING;
+				float v = -1 * (float(y) - (height / 2)) * RAY_SCALING;
+
+				glm::vec3 imagePlanePoint = glm::vec3(u, v, -cameraEnv.focalLength) + cameraEnv.position;
+				glm::vec3 rayDirection = imagePlanePoint - cameraEnv.position;
+				glm::vec3 rotatedRayDirection = glm::normalize(cameraEnv.rotation * rayDirection);
+
+				// With a visibility buffer what the pixel sees was already found by rasterising, leaving only light samples to trace
+				BVHHit hit;
+				bool hitSurface = visibility ? visibility->getHit(x, y, triangles, cameraEnv, hit) : bvh.intersect(cameraEnv.position, rotatedRayDirection, hit);
+				if (!hitSurface) {
+					if (denoiser) denoiser->clearGuides(x, y);
+					if (moved) history->clear(x, y);
+					continue;
+				}
+				int pixel = x - tile.fromX;
+				const Colour &colour = getHitColour(triangles, bvh, hit);
+				glm::vec3 normal = getHitNormal(triangles, hit);
+				glm::vec3 intersectionPoint = cameraEnv.position + hit.distance * rotatedRayDirection;
+				red[pixel] = colour.red;
+				green[pixel] = colour.green;
+				blue[pixel] = colour.blue;
+
+				// Shadow rays leave from the side of the surface the camera sees
+				glm::vec3 facingNormal = (glm::dot(normal, rotatedRayDirection) < 0.0f) ? normal : -normal;
+				shadowOrigins[pixel] = intersectionPoint + facingNormal * SHADOW_BIAS;
+				if (denoiser) denoiser->setGuides(x, y, facingNormal, hit.distance, glm::vec3(red[pixel], green[pixel], blue[pixel]) / 255.0f);
+				if (moved) history->reproject(x, y, intersectionPoint, facingNormal);
+
+				Sampler sampler(SAMPLER_TYPE, x, y);
+				const Material &material = getHitMaterial(materials, hit);
+				if (material.isSpecular()) {
+					SecondaryRays secondaryRays(triangles, materials, bvh, lightGrid, sampler, firstSample);
+					specularColours[pixel] = secondaryRays.getSpecularColour(normal, material, intersectionPoint, rotatedRayDirection, 0, 1.0f);
+					diffuseShares[pixel] = material.getDiffuseShare();
+					if (diffuseShares[pixel] <= 0.0f) continue;
+				}
 
-				Colour colour = intersection.intersectedTriangle.colour;
+				// Primitives have exact normals already, and only the scene's own triangles have vertex brightnesses worked out
+				if (shadingModel == GOURAUD_SHADING && isSceneTriangle(hit)) {
+					const std::array<float, 3> &corners = vertexBrightnesses[hit.triangleIndex];
+					brightness[pixel] = (1.0f - hit.u - hit.v) * corners[0] + hit.u * corners[1] + hit.v * corners[2];
+					continue;
+				}
+				if (shadingModel == PHONG_SHADING && isSceneTriangle(hit)) {
+					const ModelTriangle &triangle = triangles[hit.triangleIndex];
+					normal = getSmoothNormal(triangle, hit.u, hit.v);
+					shadowOrigins[pixel] = getSmoothShadowPoint(triangle, hit.u, hit.v, intersectionPoint, facingNormal) + facingNormal * SHADOW_BIAS;
+				}
 
-				
-				float brightness = BRIGHTNESS_SCALING / (distanceToLight * distanceToLight);
-				
-				glm::vec3 normalisedLightRay = glm::normalize(lightRay);
+				size_t lightCount;
+				const uint32_t *lightIndices = lightGrid.getLightsAt(intersectionPoint, lightCount);
+				for (size_t i = 0; i < lightCount; i++) {
+					const AreaLight &light = lightGrid.lights[lightIndices[i]];
+					if (glm::length(intersectionPoint - light.position) > light.getReach()) continue;
+					int sampleCount = light.getSampleCount();
+					int rows = getStrataRows(sampleCount);
+					int columns = sampleCount / rows;
+					for (int j = 0; j < sampleCount; j++) {
+						float s;
+						float t;
+						getLightSample(sampler, firstSample, 2 * lightIndices[i], j, rows, columns, s, t);
+						glm::vec3 lightRay = light.samplePoint(intersectionPoint, s, t) - intersectionPoint;
+						batch.add(lightRay, normal, light, pixel, 1.0f / sampleCount);
+						if (batch.full()) {
+							batch.shade(0.3f);
+							batch.resolve(bvh, shadowOrigins.data(), brightness.data());
+						}
+					}
+				}
+			}
+			batch.shade(0.3f);
+			batch.resolve(bvh, shadowOrigins.data(), brightness.data());
+			if (history) {
+				for (int pixel = 0; pixel < spanWidth; pixel++) brightness[pixel] = history->accumulate(tile.fromX + pixel, y, glm::vec3(brightness[pixel])).x;
+			}
 
+			// Mirror and glass pixels are finished here, as their own share lit as usual plus what their rays brought back,
+			// then shown as a fully lit surface of that colour
+			for (int pixel = 0; pixel < spanWidth; pixel++) {
+				if (diffuseShares[pixel] >= 1.0f) continue;
+				float scale = diffuseShares[pixel] * std::min(brightness[pixel] + MIN_BRIGHTNESS, 1.0f);
+				glm::vec3 colour = scale * glm::vec3(red[pixel], green[pixel], blue[pixel]) + specularColours[pixel];
+				colour = glm::min(colour, glm::vec3(255.0f));
+				red[pixel] = colour.r;
+				green[pixel] = colour.g;
+				blue[pixel] = colour.b;
+				brightness[pixel] = 1.0f;
+				if (denoiser) {
+					size_t index = y * denoiser->stride + tile.fromX + pixel;
+					for (int c = 0; c < 3; c++) denoiser->albedo[c][index] = colour[c] / 255.0f;
+				}
+			}
 
-				float angleOfIncidence = glm::dot(normalisedLightRay, intersection.intersectedTriangle.normal);
-				angleOfIncidence = std::max(angleOfIncidence, float(0.0));
-				
-				brightness = brightness * angleOfIncidence;
-
-				//std::vector<RayTriangleIntersection> validShadowIntersections;
-				//for (size_t i = 0; i < shadowIntersections.size(); i++) {
-				//	if (shadowIntersections[i].triangleIndex != intersection.triangleIndex) {
-				//		validShadowIntersections.push_back(shadowIntersections[i]);
-				//	}
-				//}
-				//if (!validShadowIntersections.empty()) {
-				//	RayTriangleIntersection shadowIntersection = getClosestIntersection(validShadowIntersections);
-				//	if (shadowIntersection.distanceFromCamera < distanceToLight) {
-				//		brightness *= SHADOW_FADE;
-				//	}
-				//} else {
-				//	brightness += 0.1f * specularCoeffcient;
-				//}
-
-				float specularCoeffcient = getSpecularCoefficient(
-					intersection.intersectedTriangle.normal, 
-					-normalisedLightRay, 
-					-rotatedRayDirection
-				);
-
-				brightness += 0.3f * specularCoeffcient;
-
-				float minBrightness = 0.2;
-
-				brightness = std::min(brightness + minBrightness, 1.0f);
-
-				Colour adjustedColour = adjustBrightness(colour, brightness);
-
-				window.setPixelColour(x, y, colourToCode(adjustedColour));
+			if (denoiser) {
+				// Brightness is the same for every channel here, the colour comes from the guides' albedo
+				// Anything brighter than the display shows is clamped first, so the odd very bright pixel doesn't stand out
+				size_t index = y * denoiser->stride + tile.fromX;
+				for (int pixel = 0; pixel < spanWidth; pixel++) {
+					for (int c = 0; c < 3; c++) denoiser->light[c][index + pixel] = std::min(brightness[pixel], 1.0f);
+				}
+				continue;
 			}
-			
+			packColours(spanWidth, brightness.data(), red.data(), green.data(), blue.data(), row.data());
+			frameBuffer.writeSpan(y, tile.fromX, tile.toX, row.data());
 		}
-	}
+	});
+	if (!denoiser) return;
+
+	denoiser->filter();
+	getTileScheduler().forEachRow(height, RENDER_TILE_SIZE, [&](size_t y) {
+		std::vector<uint32_t> row(width);
+		std::vector<float> red(width);
+		std::vector<float> green(width);
+		std::vector<float> blue(width);
+		size_t index = y * denoiser->stride;
+		for (int x = 0; x < width; x++) {
+			red[x] = denoiser->albedo[0][index + x] * 255.0f;
+			green[x] = denoiser->albedo[1][index + x] * 255.0f;
+			blue[x] = denoiser->albedo[2][index + x] * 255.0f;
+		}
+		packColours(width, &denoiser->light[0][index], red.data(), green.data(), blue.data(), row.data());
+		frameBuffer.writeSpan(int(y), 0, width, row.data());
+	});
 };
 
 void rayTrace(
-		DrawingWindow &window,
-		std::vector<ModelTriangle> triangles,
-		std::vector<Material> materials,
-		CameraEnvironment &cameraEnv,
-		glm::vec3 lightPosition){
+		FrameBuffer &frameBuffer,
+		const std::vector<ModelTriangle> &triangles,
+		const std::vector<Material> &materials,
+		const BVH &bvh,
+		const CameraEnvironment &cameraEnv,
+		const LightGrid &lightGrid,
+		Denoiser *denoiser,
+		TemporalHistory *history){
+
+	// No need to clear since every row is written in full
+	rayTraceModel(frameBuffer, triangles, materials, bvh, cameraEnv, lightGrid, denoiser, history, nullptr);
+}
 
-	window.clearPixels();
+// Ray traced lighting on rasterised visibility: only shadow rays are traced, from the surfaces the visibility buffer found
+void hybridTrace(
+		FrameBuffer &frameBuffer,
+		const std::vector<ModelTriangle> &triangles,
+		const std::vector<Material> &materials,
+		const BVH &bvh,
+		const CameraEnvironment &cameraEnv,
+		const LightGrid &lightGrid,
+		Denoiser *denoiser,
+		TemporalHistory *history,
+		VisibilityBuffer &visibility){
+	visibility.render(triangles, cameraEnv, frameBuffer.width, frameBuffer.height);
+	rayTraceModel(frameBuffer, triangles, materials, bvh, cameraEnv, lightGrid, denoiser, history, &visibility);
+}
 
-	rayTraceModel(window, triangles, materials, cameraEnv, lightPosition);
+// LIGHTMAP BAKING
+
+float LIGHTMAP_TEXELS_PER_UNIT = 64.0;
+int LIGHTMAP_MAX_CELL_SIZE = 128;
+// Rays per texel gathering light that has bounced once off other surfaces
+int LIGHTMAP_INDIRECT_SAMPLES = 32;
+// Atlas tiles baked per call to the tile scheduler, so ray traced frames can run in between
+int LIGHTMAP_TILES_PER_BATCH = 16;
+std::string LIGHTMAP_FILENAME = "lightmap.bin";
+// Fixed rather than following SAMPLER_TYPE, so a saved lightmap is what a fresh bake would give
+SamplerType LIGHTMAP_SAMPLER = SOBOL_SAMPLER;
+
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+	const unsigned char *bytes = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t hashVector(uint64_t hash, glm::vec3 vector) {
+	return hashBytes(hash, &vector[0], 3 * sizeof(float));
+}
+
+// Anything that changes what gets baked changes the key, so stale lightmaps are never loaded from disk
+uint64_t getLightmapKey(const std::vector<ModelTriangle> &triangles, const std::vector<AreaLight> &lights) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < triangles.size(); i++) {
+		for (int j = 0; j < 3; j++) hash = hashVector(hash, triangles[i].vertices[j]);
+		hash = hashBytes(hash, &triangles[i].colour.red, sizeof(int));
+		hash = hashBytes(hash, &triangles[i].colour.green, sizeof(int));
+		hash = hashBytes(hash, &triangles[i].colour.blue, sizeof(int));
+	}
+	for (size_t i = 0; i < lights.size(); i++) {
+		const AreaLight &light = lights[i];
+		int shape = light.shape;
+		hash = hashBytes(hash, &shape, sizeof(shape));
+		hash = hashVector(hash, light.position);
+		hash = hashVector(hash, light.edgeU);
+		hash = hashVector(hash, light.edgeV);
+		hash = hashBytes(hash, &light.radius, sizeof(light.radius));
+		hash = hashBytes(hash, &light.samples, sizeof(light.samples));
+		hash = hashBytes(hash, &light.intensity, sizeof(light.intensity));
+		hash = hashBytes(hash, &light.influenceRadius, sizeof(light.influenceRadius));
+	}
+	hash = hashBytes(hash, &LIGHTMAP_TEXELS_PER_UNIT, sizeof(LIGHTMAP_TEXELS_PER_UNIT));
+	hash = hashBytes(hash, &LIGHTMAP_MAX_CELL_SIZE, sizeof(LIGHTMAP_MAX_CELL_SIZE));
+	hash = hashBytes(hash, &LIGHTMAP_INDIRECT_SAMPLES, sizeof(LIGHTMAP_INDIRECT_SAMPLES));
+	return hash;
 }
 
+// Direct light at a texel plus light arriving after one bounce off the rest of the scene
+// Specular highlights depend on where the camera is, so they are left to the ray tracer
+glm::vec3 bakeTexel(
+		const std::vector<ModelTriangle> &triangles,
+		const BVH &bvh,
+		const LightGrid &lightGrid,
+		const LightGrid &bounceLightGrid,
+		glm::vec3 point,
+		glm::vec3 normal,
+		const Sampler &sampler) {
+	// The surface is lit on the side its normal points to, as it is in the ray tracer
+	// Bounce directions use dimensions 0 and 1, so light samples start after them
+	float direct = getSceneBrightness(bvh, lightGrid, point, normal, -normal, sampler, 0, 2, 0.0f);
+
+	glm::vec3 origin = point + normal * SHADOW_BIAS;
+	glm::vec3 indirect(0.0);
+	for (int i = 0; i < LIGHTMAP_INDIRECT_SAMPLES; i++) {
+		glm::vec2 sample = sampler.get2D(i, 0);
+		glm::vec3 direction = sampleCosineHemisphere(normal, sample.x, sample.y);
+		BVHHit hit;
+		if (!bvh.intersect(origin, direction, hit)) continue;
+		const Colour &hitColour = getHitColour(triangles, bvh, hit);
+		glm::vec3 hitPoint = origin + hit.distance * direction;
+		// Clamped like a ray traced pixel, which also stops surfaces right by the light turning into bright speckles
+		float hitBrightness = std::min(getSceneBrightness(bvh, bounceLightGrid, hitPoint, getHitNormal(triangles, hit), direction, sampler, i, 2, 0.0f), 1.0f);
+		glm::vec3 albedo = glm::vec3(hitColour.red, hitColour.green, hitColour.blue) / 255.0f;
+		indirect += albedo * hitBrightness;
+	}
+	return glm::vec3(direct) + indirect / float(std::max(LIGHTMAP_INDIRECT_SAMPLES, 1));
+}
+
+// Lays the triangles out in an atlas and bakes every texel, in parallel on the tile scheduler
+Lightmap bakeLightmap(const std::vector<ModelTriangle> &triangles, const BVH &bvh, const LightGrid &lightGrid) {
+	Lightmap lightmap(triangles, LIGHTMAP_TEXELS_PER_UNIT, LIGHTMAP_MAX_CELL_SIZE);
+	// One light sample per bounce is enough since the bounces are averaged anyway
+	LightGrid bounceLightGrid = lightGrid;
+	for (size_t i = 0; i < bounceLightGrid.lights.size(); i++) bounceLightGrid.lights[i].samples = 1;
+
+	int tilesX = (lightmap.width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	int tilesY = (lightmap.height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	int tileCount = tilesX * tilesY;
+	for (int firstTile = 0; firstTile < tileCount; firstTile += LIGHTMAP_TILES_PER_BATCH) {
+		int batchSize = std::min(LIGHTMAP_TILES_PER_BATCH, tileCount - firstTile);
+		getTileScheduler().parallelFor(batchSize, [&](size_t i) {
+			int tile = firstTile + int(i);
+			size_t fromX = (tile % tilesX) * RENDER_TILE_SIZE;
+			size_t fromY = (tile / tilesX) * RENDER_TILE_SIZE;
+			size_t toX = std::min(fromX + RENDER_TILE_SIZE, lightmap.width);
+			size_t toY = std::min(fromY + RENDER_TILE_SIZE, lightmap.height);
+			for (size_t y = fromY; y < toY; y++) {
+				for (size_t x = fromX; x < toX; x++) {
+					int32_t triangleIndex = lightmap.texelTriangles[y * lightmap.width + x];
+					if (triangleIndex < 0) continue;
+					Sampler sampler(LIGHTMAP_SAMPLER, x, y);
+					glm::vec3 point = lightmap.getTexelPoint(triangles, x, y);
+					lightmap.texels[y * lightmap.width + x] = bakeTexel(triangles, bvh, lightGrid, bounceLightGrid, point, triangles[triangleIndex].normal, sampler);
+				}
+			}
+		});
+	}
+	return lightmap;
+}
+
+// Loads the lightmap for this scene and its lights from LIGHTMAP_FILENAME, or bakes and saves it if there isn't one
+Lightmap loadOrBakeLightmap(const std::vector<ModelTriangle> &triangles, const BVH &bvh, const LightGrid &lightGrid) {
+	uint64_t key = getLightmapKey(triangles, lightGrid.lights);
+	Lightmap lightmap;
+	if (lightmap.load(LIGHTMAP_FILENAME, key, triangles.size())) return lightmap;
+
+	std::chrono::steady_clock::time_point bakeStart = std::chrono::steady_clock::now();
+	lightmap = bakeLightmap(triangles, bvh, lightGrid);
+	std::chrono::duration<float, std::milli> bakeTime = std::chrono::steady_clock::now() - bakeStart;
+	std::cout << "Baked " << lightmap.width << "x" << lightmap.height << " lightmap in " << bakeTime.count() << "ms" << std::endl;
+	if (!lightmap.save(LIGHTMAP_FILENAME, key)) std::cout << "Could not save lightmap to " << LIGHTMAP_FILENAME << std::endl;
+	return lightmap;
+}
+
+// SHADOW MAPS
+
+// Press E to turn shadows in deferred rasterised frames on and off
+bool SHADOW_MAPPING = true;
+
 // SHADING
 
+// Press F to switch rasterised frames between deferred lighting from the lights and forward shading from the lightmap
+bool DEFERRED_SHADING = true;
+// Share of the highlight added to diffuse light, the same as ray traced frames
+float DEFERRED_SPECULAR_WEIGHT = 0.3;
+
+// Diffuse and specular light reaching point from the centre of every light whose influence gets that far
+// With shadow maps, shadows dim diffuse light by SHADOW_FADE and hide the highlight as they do in ray traced frames
+float getDeferredBrightness(const LightGrid &lightGrid, const ShadowMaps *shadowMaps, glm::vec3 point, glm::vec3 normal, glm::vec3 rayDirection) {
+	size_t lightCount;
+	const uint32_t *lightIndices = lightGrid.getLightsAt(point, lightCount);
+	float brightness = 0.0;
+	for (size_t i = 0; i < lightCount; i++) {
+		const AreaLight &light = lightGrid.lights[lightIndices[i]];
+		glm::vec3 lightRay = light.position - point;
+		float distanceToLight = glm::length(lightRay);
+		if (distanceToLight > light.getReach()) continue;
+		glm::vec3 normalisedLightRay = lightRay / distanceToLight;
+		float influence = light.getInfluence(distanceToLight);
+		float angleOfIncidence = std::max(glm::dot(normalisedLightRay, normal), 0.0f);
+		float diffuse = BRIGHTNESS_SCALING / (distanceToLight * distanceToLight) * angleOfIncidence * influence;
+		float specular = DEFERRED_SPECULAR_WEIGHT * influence * getSpecularCoefficient(normal, -normalisedLightRay, -rayDirection);
+		// Faces turned away from the light are dark already, so aren't looked up
+		float visibility = (shadowMaps && angleOfIncidence > 0.0f) ? shadowMaps->getVisibility(lightIndices[i], point, normal) : 1.0f;
+		brightness += diffuse * (SHADOW_FADE + (1.0f - SHADOW_FADE) * visibility) + specular * visibility;
+	}
+	return brightness;
+}
+
+// Lights every pixel of the G-buffer exactly once, however many triangles were drawn over it, with rows shared out
+// over the tile scheduler
+// Each pixel's position comes back from its depth along the same ray the ray tracer would send through it
+void shadeGBuffer(FrameBuffer &frameBuffer, const GBuffer &gBuffer, const CameraEnvironment &cameraEnv, const LightGrid &lightGrid, const ShadowMaps *shadowMaps) {
+	int width = frameBuffer.width;
+	int height = frameBuffer.height;
+	float RAY_SCALING = 1.0 / getPlaneScaling(frameBuffer);
+	getTileScheduler().forEachRow(height, RENDER_TILE_SIZE, [&](size_t y) {
+		std::vector<uint32_t> row(width);
+		std::vector<float> brightness(width, 0.0f);
+		std::vector<float> red(width, 0.0f);
+		std::vector<float> green(width, 0.0f);
+		std::vector<float> blue(width, 0.0f);
+		const uint32_t *albedoRow = gBuffer.target.getRow(y);
+		const float *depthRow = gBuffer.target.getDepthRow(y);
+		for (int x = 0; x < width; x++) {
+			if (gBuffer.materialIds[y * width + x] < 0) continue;
+			float u = (float(x) - (width / 2)) * RAY_SCALING;
+			float v = -1 * (float(y) - (height / 2)) * RAY_SCALING;
+			glm::vec3 cameraRay = glm::vec3(u, v, -cameraEnv.focalLength);
+			glm::vec3 point = cameraEnv.position + cameraEnv.rotation * (cameraRay / (depthRow[x] * cameraEnv.focalLength));
+			glm::vec3 rayDirection = glm::normalize(cameraEnv.rotation * cameraRay);
+			// Smooth normals were already turned towards the camera, they can face slightly away near silhouettes
+			glm::vec3 normal = gBuffer.normals[y * width + x];
+			if (gBuffer.shadingModel != FLAT_SHADING) normal = glm::normalize(normal);
+			else if (glm::dot(normal, rayDirection) > 0.0f) normal = -normal;
+
+			if (gBuffer.shadingModel == GOURAUD_SHADING) brightness[x] = gBuffer.brightnesses[y * width + x];
+			else brightness[x] = getDeferredBrightness(lightGrid, shadowMaps, point, normal, rayDirection);
+			red[x] = (albedoRow[x] >> 16) & 0xFF;
+			green[x] = (albedoRow[x] >> 8) & 0xFF;
+			blue[x] = albedoRow[x] & 0xFF;
+		}
+		packColours(width, brightness.data(), red.data(), green.data(), blue.data(), row.data());
+		frameBuffer.writeSpan(int(y), 0, width, row.data());
+	});
+}
+
+// Rasterises albedo, depth, normals and material ids into the G-buffer, then lights the result
+// With shadow maps, any that are out of date are drawn first, and with Gouraud shading the vertices are lit before drawing
+void rasteriseDeferred(
+		FrameBuffer &frameBuffer,
+		const std::vector<ModelTriangle> &triangles,
+		const std::vector<Material> &materials,
+		const CameraEnvironment &cameraEnv,
+		const LightGrid &lightGrid,
+		GBuffer &gBuffer,
+		ShadowMaps *shadowMaps) {
+	ShadingModel shadingModel = SHADING_MODEL;
+	if (shadowMaps) shadowMaps->update(triangles, lightGrid.lights);
+	gBuffer.begin(frameBuffer.width, frameBuffer.height, shadingModel);
+	if (shadingModel == GOURAUD_SHADING) {
+		gBuffer.vertexBrightnesses.resize(triangles.size());
+		getTileScheduler().parallelFor(triangles.size(), [&](size_t i) {
+			const ModelTriangle &triangle = triangles[i];
+			for (int j = 0; j < 3; j++) {
+				glm::vec3 rayDirection = glm::normalize(triangle.vertices[j] - cameraEnv.position);
+				glm::vec3 normal = triangle.vertexNormals[j];
+				if (glm::dot(triangle.normal, rayDirection) > 0.0f) normal = -normal;
+				gBuffer.vertexBrightnesses[i][j] = getDeferredBrightness(lightGrid, shadowMaps, triangle.vertices[j], normal, rayDirection);
+			}
+		});
+	}
+	drawRasterisedModel(gBuffer.target, triangles, materials, cameraEnv, nullptr, &gBuffer);
+	shadeGBuffer(frameBuffer, gBuffer, cameraEnv, lightGrid, shadowMaps);
+}
+
+// DYNAMIC RESOLUTION
+
+float TARGET_FRAME_TIME = 33.0;
+float MIN_RESOLUTION_SCALE = 0.25;
+// Weight of the newest frame time in the running average
+float FRAME_TIME_SMOOTHING = 0.3;
+
+// Bilinearly resamples source over the whole of destination
+void upscaleBilinear(const FrameBuffer &source, FrameBuffer &destination) {
+	float scaleX = float(source.width) / destination.width;
+	float scaleY = float(source.height) / destination.height;
+
+	// Horizontal taps and 8-bit weights are the same for every row
+	std::vector<int> leftX(destination.width);
+	std::vector<int> rightX(destination.width);
+	std::vector<uint32_t> rightWeight(destination.width);
+	for (size_t x = 0; x < destination.width; x++) {
+		float sourceX = std::max((x + 0.5f) * scaleX - 0.5f, 0.0f);
+		leftX[x] = std::min(int(sourceX), int(source.width) - 1);
+		rightX[x] = std::min(leftX[x] + 1, int(source.width) - 1);
+		rightWeight[x] = uint32_t((sourceX - leftX[x]) * 256);
+	}
+
+	for (size_t y = 0; y < destination.height; y++) {
+		float sourceY = std::max((y + 0.5f) * scaleY - 0.5f, 0.0f);
+		int topY = std::min(int(sourceY), int(source.height) - 1);
+		int bottomY = std::min(topY + 1, int(source.height) - 1);
+		uint32_t bottomWeight = uint32_t((sourceY - topY) * 256);
+		const uint32_t *topRow = source.getRow(topY);
+		const uint32_t *bottomRow = source.getRow(bottomY);
+		uint32_t *row = destination.getRow(y);
+
+		for (size_t x = 0; x < destination.width; x++) {
+			uint32_t colour = 0;
+			// Blends each 8-bit channel in fixed point
+			for (int shift = 0; shift <= 16; shift += 8) {
+				uint32_t topLeft = (topRow[leftX[x]] >> shift) & 0xFF;
+				uint32_t topRight = (topRow[rightX[x]] >> shift) & 0xFF;
+				uint32_t bottomLeft = (bottomRow[leftX[x]] >> shift) & 0xFF;
+				uint32_t bottomRight = (bottomRow[rightX[x]] >> shift) & 0xFF;
+				uint32_t top = topLeft * (256 - rightWeight[x]) + topRight * rightWeight[x];
+				uint32_t bottom = bottomLeft * (256 - rightWeight[x]) + bottomRight * rightWeight[x];
+				uint32_t channel = (top * (256 - bottomWeight) + bottom * bottomWeight) >> 16;
+				colour |= channel << shift;
+			}
+			row[x] = colour;
+		}
+	}
+}
+
+// Renders at a reduced internal resolution while the view is changing so frames stay near TARGET_FRAME_TIME
+// As soon as the view stops changing, frames go back to full resolution
+class DynamicResolution {
+	public:
+		bool enabled = false;
+		float targetFrameTime = TARGET_FRAME_TIME;
+		float scale = 1.0;
+		float averageFullFrameTime = 0.0;
+		FrameBuffer lowResolutionBuffer;
+
+		// Returns the buffer this frame should be drawn into
+		FrameBuffer &beginFrame(FrameBuffer &output, bool viewChanging) {
+			rendering = enabled && viewChanging && scale < 1.0;
+			if (!rendering) return output;
+
+			size_t width = std::max(size_t(round(output.width * scale)), size_t(1));
+			size_t height = std::max(size_t(round(output.height * scale)), size_t(1));
+			if (lowResolutionBuffer.width != width || lowResolutionBuffer.height != height) {
+				lowResolutionBuffer = FrameBuffer(width, height);
+			}
+			return lowResolutionBuffer;
+		}
+
+		// Upscales into output if needed, then picks the scale for the next frame from the time this one took
+		void endFrame(FrameBuffer &output, float frameTime) {
+			if (rendering) upscaleBilinear(lowResolutionBuffer, output);
+			if (!enabled) return;
+
+			// Cost is proportional to pixel count, which goes with the square of the scale,
+			// so frame times are averaged as the time a full resolution frame would have taken
+			float scaleUsed = rendering ? scale : 1.0f;
+			float fullFrameTime = frameTime / (scaleUsed * scaleUsed);
+			if (averageFullFrameTime == 0.0) averageFullFrameTime = fullFrameTime;
+			averageFullFrameTime += FRAME_TIME_SMOOTHING * (fullFrameTime - averageFullFrameTime);
+
+			float idealScale = sqrt(targetFrameTime / std::max(averageFullFrameTime, 0.001f));
+			scale = std::min(std::max(idealScale, MIN_RESOLUTION_SCALE), 1.0f);
+		}
+
+	private:
+		bool rendering = false;
+};
+
+// ANIMATION
+
+// Z starts and stops the model twisting and rippling, which moves its triangles without adding or removing any
+// so the ray tracer's BVH is refitted around them rather than rebuilt
+bool ANIMATE = false;
+// Radians the top of the model turns relative to its middle at the height of the twist
+float ANIMATION_TWIST = 0.6;
+// Share of its width the model swells by at the crest of the ripple
+float ANIMATION_RIPPLE = 0.15;
+// Radians per second
+float ANIMATION_SPEED = 2.0;
+// Once refitting has made the BVH's surface area heuristic cost this many times worse it is rebuilt
+float MAX_BVH_DEGRADATION = 1.3;
+
+// Turns every vertex of the rest pose around the vertical axis through the model's middle, by an angle growing with height,
+// and pushes it out from that axis by a ripple travelling up the model
+// Normals turn with their vertices, which is exact for the twist and close enough for a gentle ripple
+void animateTriangles(std::vector<ModelTriangle> &triangles, const std::vector<ModelTriangle> &restTriangles, float time) {
+	glm::vec3 restMin;
+	glm::vec3 restMax;
+	getSceneBounds(restTriangles, std::vector<Primitive>(), std::vector<BVHInstance>(), restMin, restMax);
+	glm::vec3 centre = (restMin + restMax) / 2.0f;
+	float halfHeight = std::max((restMax.y - restMin.y) / 2.0f, 1e-6f);
+	float phase = time * ANIMATION_SPEED;
+	for (size_t i = 0; i < triangles.size(); i++) {
+		const ModelTriangle &rest = restTriangles[i];
+		ModelTriangle &triangle = triangles[i];
+		for (int j = 0; j < 3; j++) {
+			glm::vec3 offset = rest.vertices[j] - centre;
+			float height = offset.y / halfHeight;
+			float angle = ANIMATION_TWIST * sin(phase) * height;
+			float swell = 1.0f + ANIMATION_RIPPLE * sin(2.0f * M_PI * height - phase);
+			glm::vec3 turned = rotateY(offset, angle);
+			triangle.vertices[j] = centre + glm::vec3(turned.x * swell, turned.y, turned.z * swell);
+			triangle.vertexNormals[j] = rotateY(rest.vertexNormals[j], angle);
+		}
+		glm::vec3 normal = glm::normalize(glm::cross(triangle.vertices[1] - triangle.vertices[0], triangle.vertices[2] - triangle.vertices[0]));
+		triangle.normal = (glm::dot(normal, rest.normal) < 0.0f) ? -normal : normal;
+	}
+}
+
 // EVENT LOOPS
 
-void update(DrawingWindow &window, CameraEnvironment &cameraEnv) {
+// Milliseconds the render thread sleeps waiting for input when the scene hasn't changed
+int IDLE_TIMEOUT = 100;
+// Milliseconds without changes before a reduced resolution frame is redrawn in full
+int SETTLE_TIMEOUT = 150;
 
+// Anything that changes what would be drawn must bump sceneVersion, otherwise the frame is not redrawn
+// Returns whether the triangles moved
+bool update(
+		DrawingWindow &window,
+		CameraEnvironment &cameraEnv,
+		std::vector<ModelTriangle> &triangles,
+		const std::vector<ModelTriangle> &restTriangles,
+		float animationTime,
+		unsigned int &sceneVersion) {
+	if (!ANIMATE || triangles.empty()) return false;
+	animateTriangles(triangles, restTriangles, animationTime);
+	sceneVersion++;
+	return true;
 }
 
 void handleEvent(
@@ -784,10 +1171,15 @@ void handleEvent(
 		DrawingWindow &window,
 		CameraEnvironment &cameraEnv,
 		RenderingMethod &renderingMethod,
-		glm::vec3 &lightPosition) {
+		LightGrid &lightGrid,
+		size_t &selectedLight,
+		DynamicResolution &dynamicResolution,
+		unsigned int &sceneVersion) {
 	float TRANSLATION_STEP = 0.05;
 	float ROTATION_STEP = M_PI * 0.01;
 	if (event.type == SDL_KEYDOWN) {
+		// The light keys act on the selected light, G selects the next one
+		AreaLight &light = lightGrid.lights[selectedLight];
 		if (event.key.keysym.sym == SDLK_LEFT) cameraEnv.position += glm::vec3(-TRANSLATION_STEP, 0.0, 0.0);
 		else if (event.key.keysym.sym == SDLK_RIGHT) cameraEnv.position += glm::vec3(TRANSLATION_STEP, 0.0, 0.0);
 		else if (event.key.keysym.sym == SDLK_UP) cameraEnv.position += glm::vec3(0.0, TRANSLATION_STEP, 0.0);
@@ -808,30 +1200,366 @@ void handleEvent(
 		else if (event.key.keysym.sym == SDLK_1) renderingMethod = RASTERISE;
 		else if (event.key.keysym.sym == SDLK_2) renderingMethod = WIREFRAME;
 		else if (event.key.keysym.sym == SDLK_3) renderingMethod = RAY_TRACE;
-
-		else if (event.key.keysym.sym == SDLK_j) lightPosition += glm::vec3(-TRANSLATION_STEP, 0.0, 0.0);
-		else if (event.key.keysym.sym == SDLK_l) lightPosition += glm::vec3(TRANSLATION_STEP, 0.0, 0.0);
-		else if (event.key.keysym.sym == SDLK_i) lightPosition += glm::vec3(0.0, TRANSLATION_STEP, 0.0);
-		else if (event.key.keysym.sym == SDLK_k) lightPosition += glm::vec3(0.0, -TRANSLATION_STEP, 0.0);
+		else if (event.key.keysym.sym == SDLK_4) renderingMethod = PATH_TRACE;
+		else if (event.key.keysym.sym == SDLK_5) renderingMethod = HYBRID;
+
+		else if (event.key.keysym.sym == SDLK_j) light.position += glm::vec3(-TRANSLATION_STEP, 0.0, 0.0);
+		else if (event.key.keysym.sym == SDLK_l) light.position += glm::vec3(TRANSLATION_STEP, 0.0, 0.0);
+		else if (event.key.keysym.sym == SDLK_i) light.position += glm::vec3(0.0, TRANSLATION_STEP, 0.0);
+		else if (event.key.keysym.sym == SDLK_k) light.position += glm::vec3(0.0, -TRANSLATION_STEP, 0.0);
+
+		else if (event.key.keysym.sym == SDLK_n) light.samples = std::max(light.samples / 2, 1);
+		else if (event.key.keysym.sym == SDLK_m) light.samples = std::min(light.samples * 2, MAX_LIGHT_SAMPLES);
+		else if (event.key.keysym.sym == SDLK_p) light.shape = LightShape((light.shape + 1) % 3);
+		else if (event.key.keysym.sym == SDLK_g) selectedLight = (selectedLight + 1) % lightGrid.lights.size();
+
+		else if (event.key.keysym.sym == SDLK_r) dynamicResolution.enabled = !dynamicResolution.enabled;
+		else if (event.key.keysym.sym == SDLK_b) SAMPLER_TYPE = SamplerType((SAMPLER_TYPE + 1) % 3);
+		else if (event.key.keysym.sym == SDLK_v) DENOISE = !DENOISE;
+		else if (event.key.keysym.sym == SDLK_t) TEMPORAL_REPROJECTION = !TEMPORAL_REPROJECTION;
+		else if (event.key.keysym.sym == SDLK_f) DEFERRED_SHADING = !DEFERRED_SHADING;
+		else if (event.key.keysym.sym == SDLK_e) SHADOW_MAPPING = !SHADOW_MAPPING;
+		else if (event.key.keysym.sym == SDLK_h) SHADING_MODEL = ShadingModel((SHADING_MODEL + 1) % 3);
+		else if (event.key.keysym.sym == SDLK_z) ANIMATE = !ANIMATE;
+		else return;
+		sceneVersion++;
+		// Only moving a light or changing its shape changes the cells it reaches
+		SDL_Keycode key = event.key.keysym.sym;
+		if (key == SDLK_j || key == SDLK_l || key == SDLK_i || key == SDLK_k || key == SDLK_p) lightGrid.rebuild();
 
 
 	} else if (event.type == SDL_MOUSEBUTTONDOWN) window.savePPM("output.ppm");
 }
 
-int main(int argc, char *argv[]) {
-	DrawingWindow window = DrawingWindow(WIDTH, HEIGHT, false);
+// RENDERING
+
+// What the renderers keep from one frame to the next
+struct RendererState {
+	PathTracer pathTracer;
+	Denoiser denoiser;
+	// Ray traced and hybrid frames' samples, the path tracer keeps its own
+	TemporalHistory rayHistory{TEMPORAL_MAX_HISTORY};
+	VisibilityBuffer visibility;
+	GBuffer gBuffer;
+	ShadowMaps shadowMaps;
+};
+
+void draw(
+		FrameBuffer &frameBuffer,
+		RenderingMethod renderingMethod,
+		std::vector<ModelTriangle> &triangles,
+		std::vector<Material> &materials,
+		const BVH &bvh,
+		const Lightmap *lightmap,
+		CameraEnvironment &cameraEnv,
+		const LightGrid &lightGrid,
+		RendererState &state) {
+	if (renderingMethod == RASTERISE && DEFERRED_SHADING) {
+		rasteriseDeferred(frameBuffer, triangles, materials, cameraEnv, lightGrid, state.gBuffer, SHADOW_MAPPING ? &state.shadowMaps : nullptr);
+	} else if (renderingMethod == RASTERISE) {
+		rasterise(
+			frameBuffer,
+			triangles,
+			materials,
+			cameraEnv,
+			lightmap
+		);
+	} else if (renderingMethod == WIREFRAME) {
+		drawWireframeModel(frameBuffer, triangles, materials, cameraEnv);
+	} else if (renderingMethod == RAY_TRACE) {
+		rayTrace(frameBuffer, triangles, materials, bvh, cameraEnv, lightGrid, DENOISE ? &state.denoiser : nullptr, TEMPORAL_REPROJECTION ? &state.rayHistory : nullptr);
+	} else if (renderingMethod == HYBRID) {
+		hybridTrace(frameBuffer, triangles, materials, bvh, cameraEnv, lightGrid, DENOISE ? &state.denoiser : nullptr, TEMPORAL_REPROJECTION ? &state.rayHistory : nullptr, state.visibility);
+	} else if (renderingMethod == PATH_TRACE) {
+		state.pathTracer.render(frameBuffer, triangles, bvh, cameraEnv, lightGrid, SAMPLER_TYPE, TEMPORAL_REPROJECTION, DENOISE ? &state.denoiser : nullptr);
+	}
+}
+
+// RENDER THREAD
+
+// Input events travel from the window's thread to the render thread without locking or dropping any
+// The render thread can also sleep until input arrives when it has nothing new to draw,
+// and is told through here when to stop
+class InputQueue {
+	public:
+		InputQueue() : stopping(false) {}
+
+		bool push(const SDL_Event &event) {
+			if (!events.push(event)) return false;
+			// Taking the lock means a consumer between checking for input and sleeping can't miss this
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			inputArrived.notify_one();
+			return true;
+		}
+
+		bool pop(SDL_Event &event) {
+			return events.pop(event);
+		}
+
+		void waitForInput(int timeout) {
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			inputArrived.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return !events.empty() || stopping; });
+		}
+
+		// The render thread returns once it has finished the frame it is drawing
+		void requestStop() {
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			stopping = true;
+			inputArrived.notify_one();
+		}
+
+		bool stopRequested() const {
+			return stopping;
+		}
+
+	private:
+		SPSCQueue<SDL_Event, 1024> events;
+		std::mutex wakeMutex;
+		std::condition_variable inputArrived;
+		std::atomic<bool> stopping;
+};
+
+void renderLoop(
+		DrawingWindow &window,
+		InputQueue &inputQueue,
+		std::vector<ModelTriangle> triangles,
+		std::vector<Material> materials,
+		std::vector<Primitive> primitives,
+		std::vector<BVHInstance> instances,
+		CameraEnvironment cameraEnv,
+		LightGrid lightGrid,
+		DynamicResolution dynamicResolution) {
+	RenderingMethod renderingMethod = RAY_TRACE;
+	BVH bvh = buildBVH(triangles, primitives, instances);
+
+	// Lightmaps are baked in the background, until the first one is ready the rasteriser draws flat colours
+	std::unique_ptr<Lightmap> lightmap;
+	uint64_t lightmapKey = getLightmapKey(triangles, lightGrid.lights);
+	std::future<Lightmap> pendingLightmap = std::async(std::launch::async, loadOrBakeLightmap, std::cref(triangles), std::cref(bvh), lightGrid);
+
+	RendererState state;
+	// Accumulated samples survive the camera moving but not the lights or shading model changing
+	// or another renderer using the denoiser
+	uint64_t drawnLightsKey = lightmapKey;
+	RenderingMethod drawnMethod = renderingMethod;
+	ShadingModel drawnShadingModel = SHADING_MODEL;
+
 	SDL_Event event;
+	size_t selectedLight = 0;
+	unsigned int sceneVersion = 1;
+	unsigned int drawnVersion = 0;
+	bool drawnAtReducedResolution = false;
+	bool settling = false;
+	// Animation time only runs while animating, so it carries on from where it was stopped
+	const std::vector<ModelTriangle> restTriangles = triangles;
+	float animationTime = 0.0;
+	std::chrono::steady_clock::time_point lastUpdate = std::chrono::steady_clock::now();
+	// Leaving waits for any bake still running, as it reads the triangles
+	while (!inputQueue.stopRequested()) {
+		// Apply every input received since the last frame, in order
+		while (inputQueue.pop(event)) handleEvent(event, window, cameraEnv, renderingMethod, lightGrid, selectedLight, dynamicResolution, sceneVersion);
+
+		// Triangles are left where they are while a bake is reading them
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (ANIMATE && !pendingLightmap.valid()) animationTime += std::chrono::duration<float>(now - lastUpdate).count();
+		lastUpdate = now;
+		if (!pendingLightmap.valid() && update(window, cameraEnv, triangles, restTriangles, animationTime, sceneVersion)) {
+			bvh.refit(triangles);
+			if (bvh.getDegradation() > MAX_BVH_DEGRADATION) bvh = buildBVH(triangles, primitives, instances);
+			// The lights stay put, but the grid has to keep covering the triangles for them to find their lights
+			glm::vec3 sceneMin;
+			glm::vec3 sceneMax;
+			getSceneBounds(triangles, primitives, instances, sceneMin, sceneMax);
+			lightGrid.fit(sceneMin, sceneMax);
+			state.shadowMaps.invalidate();
+		}
+
+		// Swaps in a finished bake, and starts another if the lights have changed since it began
+		if (pendingLightmap.valid() && pendingLightmap.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+			lightmap.reset(new Lightmap(pendingLightmap.get()));
+			if (renderingMethod == RASTERISE) sceneVersion++;
+		}
+		// Moving triangles aren't baked until they stop
+		if (!pendingLightmap.valid() && !ANIMATE && getLightmapKey(triangles, lightGrid.lights) != lightmapKey) {
+			lightmapKey = getLightmapKey(triangles, lightGrid.lights);
+			pendingLightmap = std::async(std::launch::async, loadOrBakeLightmap, std::cref(triangles), std::cref(bvh), lightGrid);
+		}
+
+		// A reduced resolution frame is redrawn in full once the view settles, otherwise nothing to do
+		// unless the path or ray tracer is still refining a still view
+		bool viewChanging = sceneVersion != drawnVersion;
+		bool refining = (renderingMethod == PATH_TRACE && !state.pathTracer.converged()) ||
+			((renderingMethod == RAY_TRACE || renderingMethod == HYBRID) && TEMPORAL_REPROJECTION && !state.rayHistory.converged());
+		if (!viewChanging && !refining) {
+			if (!drawnAtReducedResolution) {
+				inputQueue.waitForInput(IDLE_TIMEOUT);
+				continue;
+			}
+			// Gives held keys a chance to repeat before paying for a full resolution frame
+			if (!settling) {
+				settling = true;
+				inputQueue.waitForInput(SETTLE_TIMEOUT);
+				continue;
+			}
+		}
+		settling = false;
+		drawnVersion = sceneVersion;
+		if (viewChanging) {
+			uint64_t lightsKey = getLightmapKey(triangles, lightGrid.lights);
+			if (lightsKey != drawnLightsKey || SHADING_MODEL != drawnShadingModel) state.rayHistory.reset();
+			if (lightsKey != drawnLightsKey || renderingMethod != drawnMethod) state.pathTracer.reset();
+			drawnLightsKey = lightsKey;
+			drawnMethod = renderingMethod;
+			drawnShadingModel = SHADING_MODEL;
+		}
+
+		std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+		FrameBuffer &target = dynamicResolution.beginFrame(window.getBackBuffer(), viewChanging);
+		drawnAtReducedResolution = &target != &window.getBackBuffer();
+		draw(target, renderingMethod, triangles, materials, bvh, lightmap.get(), cameraEnv, lightGrid, state);
+		std::chrono::duration<float, std::milli> frameTime = std::chrono::steady_clock::now() - frameStart;
+		dynamicResolution.endFrame(window.getBackBuffer(), frameTime.count());
+
+		window.swapBuffers();
+	}
+}
+
+// COMMAND LINE
+
+const char *USAGE = "Usage: LightingAndShadows [width height] [--model file.obj] [--offline output.ppm] [--path-samples count] "
+	"[--target-ms milliseconds] [--bake] [--lights count] [--analytic] [--instances count]";
+
+void printUsageAndQuit(const std::string &problem) {
+	std::cout << problem << std::endl << USAGE << std::endl;
+	exit(1);
+}
+
+// The whole of text must be a number no less than minimum, otherwise quits with the usage
+int parseInt(const std::string &name, const std::string &text, int minimum) {
+	size_t length = 0;
+	int value = 0;
+	try {
+		value = std::stoi(text, &length);
+	} catch (const std::exception &) {
+		length = 0;
+	}
+	if (length == 0 || length != text.size() || value < minimum) {
+		printUsageAndQuit(name + " must be a whole number of at least " + std::to_string(minimum) + ", not '" + text + "'");
+	}
+	return value;
+}
+
+float parsePositiveFloat(const std::string &name, const std::string &text) {
+	size_t length = 0;
+	float value = 0.0f;
+	try {
+		value = std::stof(text, &length);
+	} catch (const std::exception &) {
+		length = 0;
+	}
+	if (length == 0 || length != text.size() || !(value > 0.0f)) {
+		printUsageAndQuit(name + " must be a number above 0, not '" + text + "'");
+	}
+	return value;
+}
+
+// The options are listed in USAGE
+// With --model that OBJ file is loaded instead of the sphere, using materials from cornell-box.mtl
+// With --offline a single ray traced frame is written to the file without opening a window
+// With --path-samples as well, the frame is path traced with that many samples per pixel instead
+// With --bake LIGHTMAP_FILENAME is brought up to date for the scene without opening a window
+// With --lights that many small lights are scattered through the scene as well as the main one
+// With --analytic the model is replaced by a sphere intersected exactly, which only ray and path traced frames show
+// With --instances the model is replaced by that many smaller instanced copies of it, which only ray and path traced frames show
+// With --target-ms dynamic resolution starts enabled, aiming for that frame time (R toggles it)
+int main(int argc, char *argv[]) {
+	size_t width = DEFAULT_WIDTH;
+	size_t height = DEFAULT_HEIGHT;
+	std::string offlineFilename;
+	std::string modelFilename = "sphere.obj";
+	int pathSamples = 0;
+	bool bakeOnly = false;
+	bool analytic = false;
+	int instanceCount = 0;
+	int extraLights = 0;
+	DynamicResolution dynamicResolution;
+	std::vector<std::string> resolution;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool takesValue = arg == "--offline" || arg == "--model" || arg == "--path-samples" ||
+			arg == "--instances" || arg == "--lights" || arg == "--target-ms";
+		if (takesValue && i + 1 >= argc) printUsageAndQuit(arg + " needs a value");
+		if (arg == "--offline") offlineFilename = argv[++i];
+		else if (arg == "--model") modelFilename = argv[++i];
+		else if (arg == "--path-samples") pathSamples = parseInt(arg, argv[++i], 1);
+		else if (arg == "--bake") bakeOnly = true;
+		else if (arg == "--analytic") analytic = true;
+		else if (arg == "--instances") instanceCount = parseInt(arg, argv[++i], 0);
+		else if (arg == "--lights") extraLights = parseInt(arg, argv[++i], 0);
+		else if (arg == "--target-ms") {
+			dynamicResolution.enabled = true;
+			dynamicResolution.targetFrameTime = parsePositiveFloat(arg, argv[++i]);
+		}
+		else if (arg.compare(0, 2, "--") == 0) printUsageAndQuit("Unknown option " + arg);
+		else resolution.push_back(arg);
+	}
+	if (resolution.size() == 2) {
+		width = size_t(parseInt("width", resolution[0], 1));
+		height = size_t(parseInt("height", resolution[1], 1));
+	} else if (!resolution.empty()) printUsageAndQuit("Give both a width and a height, or neither");
+
 	std::map<std::string, Material> materialMap = loadMaterialsFromMTL("cornell-box.mtl");
 	std::vector<Material> materials;
-	std::vector<ModelTriangle> triangles = loadFromOBJ("sphere.obj", materialMap, materials);
+	std::vector<ModelTriangle> triangles = loadFromOBJ(modelFilename, materialMap, materials);
 	Material red;
 	red.colour = Colour(255,0,0);
 	red.type = TEXTURE;
 
-	for (int i = 0; i < triangles.size(); i++){
-		materials.push_back(red);
-		triangles[i].colour = Colour(255,0,0);
-		std::cout << triangles[i] << std::endl;
+	// The sphere has no materials of its own
+	if (modelFilename == "sphere.obj") {
+		for (int i = 0; i < triangles.size(); i++){
+			materials.push_back(red);
+			triangles[i].colour = Colour(255,0,0);
+			std::cout << triangles[i] << std::endl;
+		}
+	}
+
+	// Swaps the mesh for one exact sphere filling the same space, which the ray and path tracers draw without facets
+	std::vector<Primitive> primitives;
+	if (analytic && !triangles.empty()) {
+		glm::vec3 meshMin;
+		glm::vec3 meshMax;
+		getSceneBounds(triangles, primitives, std::vector<BVHInstance>(), meshMin, meshMax);
+		glm::vec3 extent = meshMax - meshMin;
+		float radius = std::max(std::max(extent.x, extent.y), extent.z) / 2.0f;
+		primitives.push_back(Primitive::sphere((meshMin + meshMax) / 2.0f, radius, triangles[0].colour));
+		triangles.clear();
+		materials.clear();
+	}
+
+	// Lays that many copies of the mesh out in a square grid facing the camera across the space it took up, each turned a little further,
+	// all sharing the one mesh and its BVH
+	std::vector<BVHInstance> instances;
+	if (instanceCount > 0 && !triangles.empty()) {
+		glm::vec3 meshMin;
+		glm::vec3 meshMax;
+		getSceneBounds(triangles, primitives, instances, meshMin, meshMax);
+		glm::vec3 centre = (meshMin + meshMax) / 2.0f;
+		glm::vec3 extent = meshMax - meshMin;
+		int side = int(ceil(sqrt(float(instanceCount))));
+		float scale = 1.0f / side;
+		std::shared_ptr<BVHMesh> mesh = std::make_shared<BVHMesh>(triangles);
+		if (WIDE_BVH) mesh->bvh.makeWide();
+		for (int i = 0; i < instanceCount; i++) {
+			glm::vec3 offset = glm::vec3(((i % side) + 0.5f) * scale - 0.5f, 0.5f - ((i / side) + 0.5f) * scale, 0.0f) * extent;
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), centre + offset);
+			transform = glm::scale(transform, glm::vec3(scale));
+			transform = glm::rotate(transform, float(i) * 0.5f, glm::vec3(0.0f, 1.0f, 0.0f));
+			transform = glm::translate(transform, -centre);
+			instances.push_back(BVHInstance(mesh, transform));
+		}
+		triangles.clear();
+		materials.clear();
 	}
 
 
@@ -844,34 +1572,83 @@ int main(int argc, char *argv[]) {
 		0.0, 0.0, 1.0
 	);
 
-	RenderingMethod renderingMethod = RAY_TRACE;
+	// FOR RAY TRACING
+	glm::vec3 sceneMin;
+	glm::vec3 sceneMax;
+	getSceneBounds(triangles, primitives, instances, sceneMin, sceneMax);
+	LightGrid lightGrid(sceneMin, sceneMax);
+
+	AreaLight light;
+	light.shape = QUAD_LIGHT;
+	light.position = glm::vec3(0.5, 0.5, 0.5);
+	light.edgeU = glm::vec3(0.2, 0.0, 0.0);
+	light.edgeV = glm::vec3(0.0, 0.0, 0.2);
+	light.radius = 0.1;
+	light.samples = 16;
+	lightGrid.lights.push_back(light);
+
+	// Dim and short-ranged, so each one only lights its own neighbourhood
+	std::mt19937 generator(0);
+	std::uniform_real_distribution<float> unit(0.0, 1.0);
+	for (int i = 0; i < extraLights; i++) {
+		AreaLight smallLight;
+		smallLight.shape = SPHERE_LIGHT;
+		smallLight.position = sceneMin + glm::vec3(unit(generator), unit(generator), unit(generator)) * (sceneMax - sceneMin);
+		smallLight.radius = 0.01;
+		smallLight.samples = 4;
+		smallLight.intensity = 0.002;
+		smallLight.influenceRadius = 0.25;
+		lightGrid.lights.push_back(smallLight);
+	}
+	lightGrid.rebuild();
 
-	// FOR RASTERISING
-	float depthBuffer[WIDTH][HEIGHT];
+	if (bakeOnly) {
+		loadOrBakeLightmap(triangles, buildBVH(triangles, primitives, instances), lightGrid);
+		return 0;
+	}
 
-	// FOR RAY TRACING
-	glm::vec3 lightPosition = glm::vec3(0.5, 0.5, 0.5);
+	if (!offlineFilename.empty()) {
+		FrameBuffer frameBuffer(width, height);
+		BVH bvh = buildBVH(triangles, primitives, instances);
+		RendererState state;
+		if (pathSamples > 0) {
+			for (int i = 0; i < pathSamples; i++) draw(frameBuffer, PATH_TRACE, triangles, materials, bvh, nullptr, cameraEnv, lightGrid, state);
+		} else draw(frameBuffer, RAY_TRACE, triangles, materials, bvh, nullptr, cameraEnv, lightGrid, state);
+		frameBuffer.savePPM(offlineFilename);
+		return 0;
+	}
 
-	
-	while (true) {
-		// We MUST poll for events - otherwise the window will freeze !
-		if (window.pollForInputEvents(event)) handleEvent(event, window, cameraEnv, renderingMethod, lightPosition);
-		
-		update(window, cameraEnv);
-		if (renderingMethod == RASTERISE) {
-			rasterise(
-				window,
-				triangles,
-				materials,
-				depthBuffer,
-				cameraEnv
-			);
-		} else if (renderingMethod == WIREFRAME) {
-			drawWireframeModel(window, triangles, materials, cameraEnv);
-		} else if (renderingMethod == RAY_TRACE) {
-			rayTrace(window, triangles, materials, cameraEnv, lightPosition);
-		} 
+	DrawingWindow window(width, height, false);
+	SDL_Event event;
+
+	InputQueue inputQueue;
+	std::thread renderThread(
+		renderLoop,
+		std::ref(window),
+		std::ref(inputQueue),
+		triangles,
+		materials,
+		primitives,
+		instances,
+		cameraEnv,
+		lightGrid,
+		std::move(dynamicResolution)
+	);
 
-		window.renderFrame();
+	while (!window.shouldQuit()) {
+		// We MUST poll for events - otherwise the window will freeze !
+		// Sleeps until there is input or the render thread has finished a frame
+		if (window.waitForInputEvents(event)) {
+			// Never drop input - only waits if the render thread is a full queue behind
+			while (!inputQueue.push(event)) std::this_thread::yield();
+		} else if (!window.shouldQuit()) {
+			window.renderFrame();
+		}
 	}
-}
\ No newline at end of file
+
+	// SDL must outlive the render thread, which pushes wake up events to it
+	inputQueue.requestStop();
+	renderThread.join();
+	window.close();
+	printMessageAndQuit("Exiting", nullptr);
+}